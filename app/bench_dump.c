@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Benchmark the hex encoder behind itd_trace_dump() against the obvious
+ * printf-loop alternative. Only the encoding is timed, not the writes to
+ * trace_marker, so no tracefs is needed.
+ */
+#include <time.h>
+#include "itd_ftrace_debugging.c" /*< Note C include! */
+
+#define BENCH_MAX_SIZE 4096U
+#define BENCH_TOTAL_BYTES (64U * 1024U * 1024U)
+
+static unsigned char payload[BENCH_MAX_SIZE];
+static char printf_hex[2U * BENCH_MAX_SIZE + 1U];
+static char encoded_hex[2U * BENCH_MAX_SIZE + 1U];
+
+static double now_s(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void printf_encode(char *dst, const unsigned char *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0U; i < len; ++i)
+		snprintf(dst + 2U * i, 3U, "%02x", src[i]);
+}
+
+static double bench(void (*encode)(char *, const unsigned char *, size_t),
+		    char *dst, const size_t len)
+{
+	const unsigned int iterations = (unsigned int)(BENCH_TOTAL_BYTES / len);
+	const double start = now_s();
+	unsigned int i;
+
+	for (i = 0U; i < iterations; ++i) {
+		encode(dst, payload, len);
+		/* Stop the compiler from hoisting the encode out of the loop */
+		__asm__ __volatile__("" : : "r"(dst) : "memory");
+	}
+
+	return (now_s() - start) * 1e9 / ((double)iterations * (double)len);
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t sizes[] = {22U, 256U, BENCH_MAX_SIZE};
+	unsigned int i;
+	int result = 0;
+
+	(void)argc;
+	(void)argv;
+
+	for (i = 0U; i < BENCH_MAX_SIZE; ++i)
+		payload[i] = (unsigned char)(i * 151U + 7U);
+
+	printf("%8s %16s %16s %8s\n", "bytes", "printf ns/byte",
+	       "encoder ns/byte", "speedup");
+
+	for (i = 0U; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		const double printf_ns = bench(printf_encode, printf_hex, sizes[i]);
+		const double encoder_ns = bench(hex_encode, encoded_hex, sizes[i]);
+
+		if (memcmp(printf_hex, encoded_hex, 2U * sizes[i]) != 0) {
+			printf("Encoder output differs for %zu bytes!\n",
+			       sizes[i]);
+			result = 1;
+		}
+
+		printf("%8zu %16.3f %16.3f %7.1fx\n", sizes[i], printf_ns,
+		       encoder_ns, printf_ns / encoder_ns);
+	}
+
+	return result;
+}
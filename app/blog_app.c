@@ -32,16 +32,51 @@
  *   library is used to make our lives a little easier. This library hides the
  *   details of what we're doing with frace, but provides a nice little API
  *   should you ever wish to use ftrace in this manner.
+ *
+ *   Run without arguments the app reproduces the problem. The -u option
+ *   instead selects an io_uring reader that batches many reads per system
+ *   call and the -l option a multi-threaded load generator. Both report
+ *   throughput and latency, see usage().
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/syscall.h>
+#include "blog_app.h"
 #include "itd_ftrace_debugging.h"
 
-#define SPECIAL_DATA_BLOCK_SIZE 22U
-#define TAG "ITDev: "
+#define DEFAULT_URING_READS 4096UL
+#define DEFAULT_URING_QUEUE_DEPTH 32U
+#define DEFAULT_LOADGEN_THREADS 4U
+
+/* Probe on the driver's special_data read function */
+#define READ_SPECIAL_PROBE "itd/read_special"
+#define HIST_BUFFER_SIZE 16384U
+
+/* Room for the start event filter, e.g. "id == 0 || id == 17" */
+#define READ_SYSCALL_FILTER_SIZE 64U
+
+/*
+ * Syscall entry to driver read latency, built in-kernel with -H. The start
+ * filter limits it to the read syscalls and is filled in at run time as the
+ * syscall numbers depend on the architecture.
+ */
+static char read_syscall_filter[READ_SYSCALL_FILTER_SIZE];
+static const struct itd_latency_hist read_latency_hist = {
+    "itd_read_lat", "raw_syscalls/sys_enter", read_syscall_filter,
+    READ_SPECIAL_PROBE, NULL};
+
+/** @brief What the app has been asked to do */
+enum blog_mode {
+    BLOG_MODE_DEMO,     /*< Original behaviour, reproduce the driver bug */
+    BLOG_MODE_URING,
+    BLOG_MODE_LOADGEN
+};
 
 /*
  * Read one block of "binary" data from the drivers "special" file.
@@ -62,6 +97,9 @@ static ssize_t print_special_data_block(const int special_file_fh)
     /* Flawfinder: ignore */
     const ssize_t bytes_read = read(special_file_fh, buffer, SPECIAL_DATA_BLOCK_SIZE); 
 
+    if (bytes_read > 0)
+        itd_trace_dump(TAG "special_data", buffer, (size_t)bytes_read);
+
     itd_trace_off();
 
     if (bytes_read > 0) {
@@ -79,24 +117,203 @@ static ssize_t print_special_data_block(const int special_file_fh)
     return bytes_read;
 }
 
-int main(void)
+static void usage(const char *const prog)
 {
-    int ret_val = EXIT_FAILURE;
-    unsigned int loop_counter = 0;
-    const int special_file_fh =
-        open("/sys/devices/itdev/special_data", O_RDONLY | O_NONBLOCK);
+    fprintf(stderr,
+            "Usage: %s [-u | -l] [-t special|cdev|both] [-n reads] [-M]\n"
+            "          [-q depth] [-b batch]\n"
+            "          [-T threads] [-c cpu-list] [-x special%%] [-r rate]\n"
+            "          [-H]\n"
+            "  With no options, read special_data twice to show the bug.\n"
+            "  -u  Use the io_uring batched reader\n"
+            "  -l  Use the multi-threaded load generator\n"
+            "  -t  File(s) to read (default special)\n"
+            "  -n  Number of reads, per thread for -l (default %lu)\n"
+            "  -M  Write a trace marker per batch (-u) or per read (-l)\n"
+            "  -q  io_uring queue depth (default %u)\n"
+            "  -b  Reads submitted per batch (default: queue depth)\n"
+            "  -T  Load generator threads (default %u)\n"
+            "  -c  CPUs to pin threads to, e.g. 0,2,4-7 (default: none)\n"
+            "  -x  Percentage of reads from special_data, overrides -t\n"
+            "  -r  Open loop reads/s per thread (default: closed loop)\n"
+            "  -H  Have the kernel histogram syscall to driver read latency\n"
+            "      (not with -u, io_uring reads never enter a read syscall)\n",
+            prog, DEFAULT_URING_READS, DEFAULT_URING_QUEUE_DEPTH,
+            DEFAULT_LOADGEN_THREADS);
+}
 
-    if (special_file_fh < 0) {
-        perror("Failed to open driver special_file");
-        goto exit_main;
+/*
+ * Parse a strictly positive integer option argument.
+ */
+static int parse_count(const char *const arg, unsigned long *const value)
+{
+    char *end = NULL;
+
+    errno = 0;
+    *value = strtoul(arg, &end, 0);
+    if (errno || !end || *end != '\0' || *value == 0U)
+        return -EINVAL;
+
+    return 0;
+}
+
+/*
+ * Parse a CPU list such as "0,2,4-7" into opts->cpus.
+ */
+static int parse_cpu_list(const char *const arg, struct blog_options *opts)
+{
+    const char *pos = arg;
+
+    opts->nr_cpus = 0U;
+    while (*pos) {
+        char *end = NULL;
+        unsigned long first;
+        unsigned long last;
+
+        errno = 0;
+        first = strtoul(pos, &end, 10);
+        if (errno || end == pos)
+            return -EINVAL;
+        last = first;
+
+        if (*end == '-') {
+            pos = end + 1;
+            last = strtoul(pos, &end, 10);
+            if (errno || end == pos || last < first)
+                return -EINVAL;
+        }
+
+        for (; first <= last; ++first) {
+            if (first >= BLOG_MAX_CPUS || opts->nr_cpus >= BLOG_MAX_CPUS)
+                return -EINVAL;
+            opts->cpus[opts->nr_cpus++] = (unsigned int)first;
+        }
+
+        if (*end == ',')
+            ++end;
+        else if (*end != '\0')
+            return -EINVAL;
+        pos = end;
     }
 
-    if (itd_init_debug_tracing() < 0) {
-        perror("Failed to initialise debug tracing");
-        goto exit_main;
+    return opts->nr_cpus ? 0 : -EINVAL;
+}
+
+static int parse_options(int argc, char *argv[], struct blog_options *opts,
+                         enum blog_mode *const mode)
+{
+    bool special_percent_set = false;
+    unsigned long value;
+    int opt;
+
+    opts->target = BLOG_TARGET_SPECIAL;
+    opts->reads = DEFAULT_URING_READS;
+    opts->queue_depth = DEFAULT_URING_QUEUE_DEPTH;
+    opts->batch_size = 0U;
+    opts->batch_markers = false;
+    opts->threads = DEFAULT_LOADGEN_THREADS;
+    opts->nr_cpus = 0U;
+    opts->rate = 0U;
+    opts->latency_hist = false;
+    *mode = BLOG_MODE_DEMO;
+
+    while ((opt = getopt(argc, argv, "ult:n:q:b:MT:c:x:r:H")) != -1) {
+        switch (opt) {
+        case 'u':
+            *mode = BLOG_MODE_URING;
+            break;
+        case 'l':
+            *mode = BLOG_MODE_LOADGEN;
+            break;
+        case 't':
+            if (strcmp(optarg, "special") == 0)
+                opts->target = BLOG_TARGET_SPECIAL;
+            else if (strcmp(optarg, "cdev") == 0)
+                opts->target = BLOG_TARGET_CDEV;
+            else if (strcmp(optarg, "both") == 0)
+                opts->target = BLOG_TARGET_BOTH;
+            else
+                return -EINVAL;
+            break;
+        case 'n':
+            if (parse_count(optarg, &opts->reads))
+                return -EINVAL;
+            break;
+        case 'q':
+            if (parse_count(optarg, &value) || value > 4096U)
+                return -EINVAL;
+            opts->queue_depth = (unsigned int)value;
+            break;
+        case 'b':
+            if (parse_count(optarg, &value) || value > 4096U)
+                return -EINVAL;
+            opts->batch_size = (unsigned int)value;
+            break;
+        case 'M':
+            opts->batch_markers = true;
+            break;
+        case 'T':
+            if (parse_count(optarg, &value) || value > BLOG_MAX_THREADS)
+                return -EINVAL;
+            opts->threads = (unsigned int)value;
+            break;
+        case 'c':
+            if (parse_cpu_list(optarg, opts))
+                return -EINVAL;
+            break;
+        case 'x':
+            /* 0 is a valid percentage, so parse_count() will not do */
+            if (strcmp(optarg, "0") == 0)
+                value = 0U;
+            else if (parse_count(optarg, &value) || value > 100U)
+                return -EINVAL;
+            opts->special_percent = (unsigned int)value;
+            special_percent_set = true;
+            break;
+        case 'r':
+            if (parse_count(optarg, &value))
+                return -EINVAL;
+            opts->rate = value;
+            break;
+        case 'H':
+            opts->latency_hist = true;
+            break;
+        default:
+            return -EINVAL;
+        }
     }
 
-    itd_trace_print(TAG "app start\n");
+    if (optind != argc)
+        return -EINVAL;
+
+    /* io-wq workers make the reads, so start and end never share a pid */
+    if (opts->latency_hist && *mode == BLOG_MODE_URING)
+        return -EINVAL;
+
+    /* A batch can never be bigger than the number of reads in flight */
+    if (opts->batch_size == 0U || opts->batch_size > opts->queue_depth)
+        opts->batch_size = opts->queue_depth;
+
+    if (!special_percent_set)
+        opts->special_percent = opts->target == BLOG_TARGET_SPECIAL ? 100U :
+                                opts->target == BLOG_TARGET_CDEV ? 0U : 50U;
+
+    return 0;
+}
+
+/*
+ * The original behaviour of the app: read the special file twice so that the
+ * driver bug can be seen in the trace.
+ */
+static int run_special_data_demo(void)
+{
+    unsigned int loop_counter = 0;
+    const int special_file_fh = open(SPECIAL_DATA_PATH, O_RDONLY | O_NONBLOCK);
+
+    if (special_file_fh < 0) {
+        perror("Failed to open driver special_file");
+        return -1;
+    }
 
     /*
      * Read from the file twice. The driver writers intent was that data
@@ -111,11 +328,101 @@ int main(void)
             break;
     }
 
+    close(special_file_fh);
+    return 0;
+}
+
+/*
+ * Have the kernel build a histogram of the time from a task entering a read
+ * system call to it reaching the driver's special_data read function, so
+ * only the histogram has to be read back rather than a whole trace.
+ */
+static int start_read_latency_hist(void)
+{
+    int result;
+
+    snprintf(read_syscall_filter, sizeof(read_syscall_filter),
+             "id == %ld || id == %ld", (long)SYS_read, (long)SYS_pread64);
+
+    result = itd_kprobe_create(READ_SPECIAL_PROBE,
+                               "itdev_example_cdev_read_special_data");
+
+    if (result) {
+        fprintf(stderr, "Failed to create kprobe: %s\n", strerror(-result));
+        return result;
+    }
+
+    result = itd_latency_hist_create(&read_latency_hist);
+    if (result) {
+        fprintf(stderr, "Failed to create latency histogram: %s\n",
+                strerror(-result));
+        itd_kprobe_destroy(READ_SPECIAL_PROBE);
+    }
+
+    return result;
+}
+
+static void stop_read_latency_hist(void)
+{
+    static char hist_buffer[HIST_BUFFER_SIZE];
+    const ssize_t result =
+        itd_latency_hist_read(&read_latency_hist, hist_buffer,
+                              sizeof(hist_buffer));
+
+    if (result < 0)
+        fprintf(stderr, "Failed to read latency histogram: %s\n",
+                strerror((int)-result));
+    else
+        printf("Syscall to driver read latency (ns):\n%s", hist_buffer);
+
+    itd_latency_hist_destroy(&read_latency_hist);
+    itd_kprobe_destroy(READ_SPECIAL_PROBE);
+}
+
+int main(int argc, char *argv[])
+{
+    int ret_val = EXIT_FAILURE;
+    static struct blog_options opts; /* Large - keep it off the stack */
+    enum blog_mode mode;
+    int result;
+
+    if (parse_options(argc, argv, &opts, &mode)) {
+        usage(argv[0]);
+        goto exit_main;
+    }
+
+    if (itd_init_debug_tracing() < 0) {
+        perror("Failed to initialise debug tracing");
+        goto exit_main;
+    }
+
+    if (opts.latency_hist && start_read_latency_hist() < 0)
+        goto exit_uninit;
+
+    itd_trace_print(TAG "app start\n");
+
+    switch (mode) {
+    case BLOG_MODE_URING:
+        result = blog_run_uring_reader(&opts);
+        break;
+    case BLOG_MODE_LOADGEN:
+        result = blog_run_loadgen(&opts);
+        break;
+    default:
+        result = run_special_data_demo();
+        break;
+    }
+
     itd_trace_print(TAG "app end\n");
-    itd_uninit_debug_tracing();
 
-    close(special_file_fh);
-    ret_val = EXIT_SUCCESS;
+    if (opts.latency_hist)
+        stop_read_latency_hist();
+
+    if (result == 0)
+        ret_val = EXIT_SUCCESS;
+
+exit_uninit:
+    itd_uninit_debug_tracing();
 
 exit_main:
     return ret_val;
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef BLOG_APP_H
+#define BLOG_APP_H
+
+#include <stdbool.h>
+
+#define SPECIAL_DATA_BLOCK_SIZE 22U
+#define TAG "ITDev: "
+
+#define SPECIAL_DATA_PATH "/sys/devices/itdev/special_data"
+#define CDEV_PATH "/dev/itdev0"
+
+/* Upper limits on load generator threads and the CPUs they can be pinned to */
+#define BLOG_MAX_THREADS 256U
+#define BLOG_MAX_CPUS 1024U
+
+/** @brief Which of the driver's files the reader modes read from */
+enum blog_target {
+    BLOG_TARGET_SPECIAL,
+    BLOG_TARGET_CDEV,
+    BLOG_TARGET_BOTH
+};
+
+/** @brief Settings taken from the command line */
+struct blog_options {
+    enum blog_target target;
+    unsigned long reads;        /*< Total number of reads to make */
+    unsigned int queue_depth;   /*< io_uring submission queue depth */
+    unsigned int batch_size;    /*< Reads submitted per io_uring_enter() */
+    bool batch_markers;         /*< Write a trace marker for every batch */
+
+    unsigned int threads;       /*< Load generator threads */
+    unsigned int cpus[BLOG_MAX_CPUS]; /*< CPUs to pin threads to, round robin */
+    unsigned int nr_cpus;       /*< Entries in cpus, 0 for no pinning */
+    unsigned int special_percent; /*< Share of reads from special_data */
+    unsigned long rate;         /*< Reads/s per thread, 0 for closed loop */
+
+    bool latency_hist;          /*< Histogram read latency in the kernel */
+};
+
+/**
+ * @brief Read the driver's files through io_uring using registered buffers
+ *        and batched submission and completion, then report the throughput,
+ *        syscalls per MB and completion latency percentiles.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+int blog_run_uring_reader(const struct blog_options *const opts);
+
+/**
+ * @brief Run `threads` readers, each optionally pinned to a CPU, that read a
+ *        mix of the driver's files either as fast as possible (closed loop)
+ *        or at a fixed rate (open loop). Per-thread and aggregate throughput
+ *        and tail latency are reported once every thread has finished.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+int blog_run_loadgen(const struct blog_options *const opts);
+
+#endif /* BLOG_APP_H */
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * DESCRIPTION:
+ *   A multi-threaded load generator for the driver. Each thread opens its own
+ *   file handles, is optionally pinned to a CPU and reads a random mix of
+ *   /dev/itdev0 and special_data.
+ *
+ *   In closed loop mode each thread issues its next read as soon as the last
+ *   one returns. In open loop mode each thread issues reads on a fixed
+ *   schedule and latency is measured from the time the read *should* have
+ *   started, so a stalled thread is not hidden by the reads it failed to
+ *   issue.
+ *
+ *   Threads only ever touch their own statistics, which are merged after
+ *   they have all been joined. With -M every read is bracketed by a marker
+ *   naming the thread and CPU, so that scheduler and lock effects can be
+ *   lined up against the driver calls in the ftrace output.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "blog_app.h"
+#include "blog_stats.h"
+#include "itd_ftrace_debugging.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+/* Big enough for either of the driver's files */
+#define LOADGEN_READ_SIZE 64U
+
+/** @brief Releases all threads at once so that they really do contend */
+struct loadgen_start {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool go;
+    bool abort;                 /*< Set instead of go if a thread failed */
+};
+
+/** @brief State owned by one load generator thread */
+struct loadgen_thread {
+    pthread_t thread;
+    unsigned int id;
+    int cpu;                    /*< CPU pinned to, or -1 */
+    const struct blog_options *opts;
+    struct loadgen_start *start;
+    struct blog_stats stats;
+    int result;
+} __attribute__((aligned(64))); /* Keep threads' state off each other's lines */
+
+/*
+ * xorshift32 - good enough to pick which file to read without a shared or
+ * locked random number generator.
+ */
+static uint32_t next_random(uint32_t *const state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void sleep_until_ns(const uint64_t deadline_ns)
+{
+    struct timespec deadline;
+
+    deadline.tv_sec = (time_t)(deadline_ns / NS_PER_SEC);
+    deadline.tv_nsec = (long)(deadline_ns % NS_PER_SEC);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+           EINTR)
+        ;
+}
+
+static int run_reads(struct loadgen_thread *const self, const int special_fh,
+                     const int cdev_fh)
+{
+    const struct blog_options *const opts = self->opts;
+    const uint64_t interval_ns = opts->rate ? NS_PER_SEC / opts->rate : 0U;
+    uint32_t random_state = 2463534242U + self->id * 2654435761U;
+    char buffer[LOADGEN_READ_SIZE];
+    uint64_t start_ns;
+    unsigned long i;
+
+    self->stats.start_ns = blog_now_ns();
+
+    for (i = 0U; i < opts->reads; ++i) {
+        const bool read_special =
+            next_random(&random_state) % 100U < opts->special_percent;
+        ssize_t bytes_read;
+
+        if (interval_ns) {
+            start_ns = self->stats.start_ns + i * interval_ns;
+            if (blog_now_ns() < start_ns)
+                sleep_until_ns(start_ns);
+        } else {
+            start_ns = blog_now_ns();
+        }
+
+        if (opts->batch_markers)
+            itd_trace_print(TAG "T%u cpu%d read %s %lu\n", self->id, self->cpu,
+                            read_special ? "special" : "cdev", i);
+
+        /* Always offset 0 so that neither file is ever exhausted */
+        /* Flawfinder: ignore */
+        bytes_read = pread(read_special ? special_fh : cdev_fh, buffer,
+                           read_special ? SPECIAL_DATA_BLOCK_SIZE
+                                        : LOADGEN_READ_SIZE,
+                           0);
+        ++self->stats.syscalls;
+
+        if (bytes_read < 0) {
+            if (self->stats.errors++ == 0U)
+                fprintf(stderr, "Thread %u failed to read device: %s\n",
+                        self->id, strerror(errno));
+            continue;
+        }
+
+        blog_stats_record(&self->stats, blog_now_ns() - start_ns,
+                          (size_t)bytes_read);
+    }
+
+    self->stats.end_ns = blog_now_ns();
+    return 0;
+}
+
+static void *loadgen_thread_main(void *const arg)
+{
+    struct loadgen_thread *const self = arg;
+    int special_fh = -1;
+    int cdev_fh = -1;
+
+    if (self->opts->special_percent > 0U) {
+        special_fh = open(SPECIAL_DATA_PATH, O_RDONLY);
+        if (special_fh < 0)
+            self->result = -errno;
+    }
+    if (self->opts->special_percent < 100U) {
+        cdev_fh = open(CDEV_PATH, O_RDONLY);
+        if (cdev_fh < 0)
+            self->result = -errno;
+    }
+
+    pthread_mutex_lock(&self->start->lock);
+    while (!self->start->go && !self->start->abort)
+        pthread_cond_wait(&self->start->cond, &self->start->lock);
+    if (self->start->abort && self->result == 0)
+        self->result = -ECANCELED;
+    pthread_mutex_unlock(&self->start->lock);
+
+    if (self->result == 0) {
+        itd_trace_print(TAG "T%u cpu%d start\n", self->id, self->cpu);
+        self->result = run_reads(self, special_fh, cdev_fh);
+        itd_trace_print(TAG "T%u cpu%d end\n", self->id, self->cpu);
+    }
+
+    if (special_fh >= 0)
+        close(special_fh);
+    if (cdev_fh >= 0)
+        close(cdev_fh);
+
+    return NULL;
+}
+
+static int start_thread(struct loadgen_thread *const self)
+{
+    pthread_attr_t attr;
+    int result;
+
+    result = pthread_attr_init(&attr);
+    if (result)
+        return -result;
+
+    if (self->cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET((size_t)self->cpu, &cpus);
+        result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    if (result == 0)
+        result = pthread_create(&self->thread, &attr, loadgen_thread_main,
+                                self);
+
+    pthread_attr_destroy(&attr);
+    return -result;
+}
+
+int blog_run_loadgen(const struct blog_options *const opts)
+{
+    struct loadgen_thread *threads;
+    struct blog_stats total;
+    struct loadgen_start start = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, false};
+    unsigned int started = 0U;
+    unsigned int i;
+    int result;
+
+    threads = aligned_alloc(64U, opts->threads * sizeof(*threads));
+    if (!threads)
+        return -ENOMEM;
+    memset(threads, 0, opts->threads * sizeof(*threads));
+
+    result = blog_stats_init(&total, 0U);
+    if (result)
+        goto exit_free_threads;
+
+    for (i = 0U; i < opts->threads; ++i) {
+        threads[i].id = i;
+        threads[i].cpu = opts->nr_cpus ? (int)opts->cpus[i % opts->nr_cpus]
+                                       : -1;
+        threads[i].opts = opts;
+        threads[i].start = &start;
+        result = blog_stats_init(&threads[i].stats, opts->reads);
+        if (result)
+            goto exit_free_stats;
+    }
+
+    /* Markers from many threads must not toggle tracing under each other */
+    itd_trace_on();
+    itd_trace_print(TAG "loadgen start: %u threads, %lu reads each, %s\n",
+                    opts->threads, opts->reads,
+                    opts->rate ? "open loop" : "closed loop");
+
+    for (; started < opts->threads; ++started) {
+        result = start_thread(&threads[started]);
+        if (result) {
+            fprintf(stderr, "Failed to start thread %u: %s\n", started,
+                    strerror(-result));
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&start.lock);
+    if (result)
+        start.abort = true;
+    else
+        start.go = true;
+    pthread_cond_broadcast(&start.cond);
+    pthread_mutex_unlock(&start.lock);
+
+    for (i = 0U; i < started; ++i)
+        pthread_join(threads[i].thread, NULL);
+
+    itd_trace_print(TAG "loadgen end\n");
+    itd_trace_off();
+
+    for (i = 0U; i < started && result == 0; ++i) {
+        char label[64];
+
+        if (threads[i].result) {
+            fprintf(stderr, "Thread %u failed: %s\n", i,
+                    strerror(-threads[i].result));
+            result = threads[i].result;
+            break;
+        }
+
+        snprintf(label, sizeof(label), "thread %u (cpu %d)", i,
+                 threads[i].cpu);
+        /* Merge before reporting - the report sorts the samples */
+        result = blog_stats_merge(&total, &threads[i].stats);
+        blog_stats_report(&threads[i].stats, label, stdout);
+    }
+
+    if (result == 0)
+        blog_stats_report(&total, "all threads", stdout);
+
+exit_free_stats:
+    for (i = 0U; i < opts->threads; ++i)
+        blog_stats_free(&threads[i].stats);
+    blog_stats_free(&total);
+exit_free_threads:
+    free(threads);
+    return result;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "blog_stats.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define BYTES_PER_MB (1024.0 * 1024.0)
+
+uint64_t blog_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+int blog_stats_init(struct blog_stats *const stats, const size_t capacity)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (capacity == 0U)
+        return 0;
+
+    /* calloc() rather than malloc() so a huge capacity cannot wrap */
+    stats->latency_ns = calloc(capacity, sizeof(*stats->latency_ns));
+    if (!stats->latency_ns)
+        return -ENOMEM;
+    stats->capacity = capacity;
+
+    return 0;
+}
+
+void blog_stats_free(struct blog_stats *const stats)
+{
+    free(stats->latency_ns);
+    stats->latency_ns = NULL;
+    stats->capacity = 0U;
+    stats->count = 0U;
+}
+
+int blog_stats_merge(struct blog_stats *const dst,
+                     const struct blog_stats *const src)
+{
+    if (dst->count + src->count > dst->capacity) {
+        const size_t new_capacity = dst->count + src->count;
+        uint64_t *new_samples;
+
+        if (new_capacity > SIZE_MAX / sizeof(*new_samples))
+            return -ENOMEM;
+        new_samples =
+            realloc(dst->latency_ns, new_capacity * sizeof(*new_samples));
+        if (!new_samples)
+            return -ENOMEM;
+        dst->latency_ns = new_samples;
+        dst->capacity = new_capacity;
+    }
+
+    if (src->count)
+        memcpy(dst->latency_ns + dst->count, src->latency_ns,
+               src->count * sizeof(*src->latency_ns));
+    dst->count += src->count;
+    dst->reads += src->reads;
+    dst->bytes += src->bytes;
+    dst->errors += src->errors;
+    dst->syscalls += src->syscalls;
+
+    if (dst->start_ns == 0U || (src->start_ns && src->start_ns < dst->start_ns))
+        dst->start_ns = src->start_ns;
+    if (src->end_ns > dst->end_ns)
+        dst->end_ns = src->end_ns;
+
+    return 0;
+}
+
+static int compare_u64(const void *const a, const void *const b)
+{
+    const uint64_t lhs = *(const uint64_t *)a;
+    const uint64_t rhs = *(const uint64_t *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/*
+ * Nearest-rank percentile of an already sorted sample set.
+ */
+static uint64_t percentile(const struct blog_stats *const stats,
+                           const unsigned int per_mille)
+{
+    size_t rank;
+
+    if (stats->count == 0U)
+        return 0U;
+
+    rank = (stats->count * per_mille + 999U) / 1000U;
+    if (rank == 0U)
+        rank = 1U;
+
+    return stats->latency_ns[rank - 1U];
+}
+
+void blog_stats_report(struct blog_stats *const stats, const char *const label,
+                       FILE *const out)
+{
+    const double elapsed_s =
+        (double)(stats->end_ns - stats->start_ns) / (double)NS_PER_SEC;
+    const double megabytes = (double)stats->bytes / BYTES_PER_MB;
+
+    qsort(stats->latency_ns, stats->count, sizeof(*stats->latency_ns),
+          compare_u64);
+
+    fprintf(out, "%s:\n", label);
+    fprintf(out, "  reads         %llu (%llu errors)\n",
+            (unsigned long long)stats->reads,
+            (unsigned long long)stats->errors);
+    fprintf(out, "  bytes         %llu in %.3f s\n",
+            (unsigned long long)stats->bytes, elapsed_s);
+    fprintf(out, "  throughput    %.3f MB/s, %.0f reads/s\n",
+            elapsed_s > 0.0 ? megabytes / elapsed_s : 0.0,
+            elapsed_s > 0.0 ? (double)stats->reads / elapsed_s : 0.0);
+    fprintf(out, "  syscalls/MB   %.1f (%llu syscalls)\n",
+            megabytes > 0.0 ? (double)stats->syscalls / megabytes : 0.0,
+            (unsigned long long)stats->syscalls);
+    fprintf(out, "  latency (ns)  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  "
+                 "max %llu\n",
+            (unsigned long long)percentile(stats, 500U),
+            (unsigned long long)percentile(stats, 900U),
+            (unsigned long long)percentile(stats, 990U),
+            (unsigned long long)percentile(stats, 999U),
+            (unsigned long long)percentile(stats, 1000U));
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef BLOG_STATS_H
+#define BLOG_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief Throughput and latency samples collected by one reader.
+ *
+ * Each reader owns its own instance so nothing is shared on the hot path;
+ * instances are combined with blog_stats_merge() once the run is over.
+ */
+struct blog_stats {
+    uint64_t *latency_ns;   /*< One sample per completed read */
+    size_t count;           /*< Number of valid samples in latency_ns */
+    size_t capacity;        /*< Allocated size of latency_ns */
+    uint64_t reads;         /*< Total completed reads */
+    uint64_t bytes;         /*< Total bytes read */
+    uint64_t errors;        /*< Reads that returned an error */
+    uint64_t syscalls;      /*< System calls made to move the data */
+    uint64_t start_ns;      /*< Monotonic time the run started */
+    uint64_t end_ns;        /*< Monotonic time the run finished */
+};
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+uint64_t blog_now_ns(void);
+
+/**
+ * @brief Allocate room for `capacity` latency samples.
+ *
+ * @return 0 on success or -ENOMEM.
+ */
+int blog_stats_init(struct blog_stats *const stats, const size_t capacity);
+
+/**
+ * @brief Free the sample buffer.
+ */
+void blog_stats_free(struct blog_stats *const stats);
+
+/**
+ * @brief Record one completed read. Samples beyond the capacity still count
+ *        towards the byte total but are not kept for the percentiles.
+ */
+static inline void blog_stats_record(struct blog_stats *const stats,
+                                     const uint64_t latency_ns,
+                                     const size_t bytes)
+{
+    if (stats->count < stats->capacity)
+        stats->latency_ns[stats->count++] = latency_ns;
+    ++stats->reads;
+    stats->bytes += bytes;
+}
+
+/**
+ * @brief Append the samples and totals of `src` to `dst`. The run window of
+ *        `dst` is widened to cover both.
+ *
+ * @return 0 on success or -ENOMEM.
+ */
+int blog_stats_merge(struct blog_stats *const dst,
+                     const struct blog_stats *const src);
+
+/**
+ * @brief Print throughput, syscalls per MB and latency percentiles.
+ *
+ * Sorts the latency samples in place.
+ */
+void blog_stats_report(struct blog_stats *const stats, const char *const label,
+                       FILE *const out);
+
+#endif /* BLOG_STATS_H */
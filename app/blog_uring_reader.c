@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * DESCRIPTION:
+ *   An io_uring based reader for the driver's files. Rather than one blocking
+ *   read() per block, `queue_depth` reads are kept in flight. The app only
+ *   blocks once fewer than `batch_size` slots are free and then reaps a batch
+ *   whilst the rest of the queue is still in flight, so a single
+ *   io_uring_enter() both submits and reaps about a batch at a time. All
+ *   reads land in one registered buffer arena so the kernel does not have to
+ *   pin user pages per read.
+ *
+ *   Every read is made at offset 0. This keeps both files "infinite" in the
+ *   way the driver author intended, whatever the file position would be.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "blog_app.h"
+#include "blog_stats.h"
+#include "itd_uring.h"
+#include "itd_ftrace_debugging.h"
+
+/* Room for one read in the registered arena. Larger than either file's block */
+#define URING_SLOT_SIZE 64U
+
+/** @brief Per run state of the io_uring reader */
+struct uring_reader {
+    struct itd_uring ring;
+    int special_fh;
+    int cdev_fh;
+    char *arena;                /*< depth * URING_SLOT_SIZE registered bytes */
+    uint64_t *submit_ns;        /*< Submission time of each slot's read */
+    unsigned int *free_slots;   /*< Stack of slots with no read in flight */
+    unsigned int free_top;
+};
+
+static int open_target_files(struct uring_reader *const reader,
+                             const enum blog_target target)
+{
+    if (target != BLOG_TARGET_CDEV) {
+        reader->special_fh = open(SPECIAL_DATA_PATH, O_RDONLY);
+        if (reader->special_fh < 0) {
+            perror("Failed to open driver special_file");
+            return -errno;
+        }
+    }
+
+    if (target != BLOG_TARGET_SPECIAL) {
+        reader->cdev_fh = open(CDEV_PATH, O_RDONLY);
+        if (reader->cdev_fh < 0) {
+            perror("Failed to open driver cdev");
+            return -errno;
+        }
+    }
+
+    return 0;
+}
+
+static void close_target_files(struct uring_reader *const reader)
+{
+    if (reader->special_fh >= 0)
+        close(reader->special_fh);
+    if (reader->cdev_fh >= 0)
+        close(reader->cdev_fh);
+}
+
+/*
+ * Queue one read into a free slot. For BLOG_TARGET_BOTH the reads alternate
+ * between the two files.
+ */
+static void queue_read(struct uring_reader *const reader,
+                       const struct blog_options *const opts,
+                       const unsigned long read_no, const uint64_t now_ns)
+{
+    const unsigned int slot = reader->free_slots[--reader->free_top];
+    const bool read_special =
+        opts->target == BLOG_TARGET_SPECIAL ||
+        (opts->target == BLOG_TARGET_BOTH && (read_no & 1U) == 0U);
+
+    reader->submit_ns[slot] = now_ns;
+    /* Cannot fail - there are never more reads in flight than SQ entries */
+    (void)itd_uring_prep_read_fixed(
+        &reader->ring, read_special ? reader->special_fh : reader->cdev_fh,
+        reader->arena + (size_t)slot * URING_SLOT_SIZE,
+        read_special ? SPECIAL_DATA_BLOCK_SIZE : URING_SLOT_SIZE, 0U, 0U,
+        slot);
+}
+
+/*
+ * Consume every completion that is already posted, without a system call.
+ */
+static unsigned int reap_completions(struct uring_reader *const reader,
+                                     struct blog_stats *const stats)
+{
+    unsigned int reaped = 0U;
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = itd_uring_peek_cqe(&reader->ring)) != NULL) {
+        const unsigned int slot = (unsigned int)cqe->user_data;
+        const uint64_t latency_ns = blog_now_ns() - reader->submit_ns[slot];
+
+        if (cqe->res < 0) {
+            if (stats->errors++ == 0U)
+                fprintf(stderr, "Failed to read device: %s\n",
+                        strerror(-cqe->res));
+        } else {
+            blog_stats_record(stats, latency_ns, (size_t)cqe->res);
+        }
+
+        reader->free_slots[reader->free_top++] = slot;
+        itd_uring_cqe_seen(&reader->ring);
+        ++reaped;
+    }
+
+    return reaped;
+}
+
+static int run_batches(struct uring_reader *const reader,
+                       const struct blog_options *const opts,
+                       struct blog_stats *const stats)
+{
+    unsigned long submitted = 0U;
+    unsigned long completed = 0U;
+    unsigned long batch_no = 0U;
+    unsigned int in_flight = 0U;
+
+    while (completed < opts->reads) {
+        const uint64_t now_ns = blog_now_ns();
+        unsigned int queued = 0U;
+        unsigned int wait_nr;
+        int result;
+
+        /* Keep the ring full - every free slot gets a new read */
+        while (reader->free_top > 0U && submitted < opts->reads) {
+            queue_read(reader, opts, submitted, now_ns);
+            ++queued;
+            ++submitted;
+        }
+
+        if (opts->batch_markers && queued)
+            itd_trace_print(TAG "uring batch %lu: %u reads\n", batch_no,
+                            queued);
+        ++batch_no;
+
+        in_flight += queued;
+
+        /*
+         * Only block once fewer than a batch of slots are free, and then
+         * only until a batch is free again, so that one batch is reaped
+         * whilst the rest of the queue is still in flight. Once everything
+         * has been submitted wait for at least one completion rather than
+         * spin.
+         */
+        wait_nr = reader->free_top < opts->batch_size
+                      ? opts->batch_size - reader->free_top
+                      : 0U;
+        if (wait_nr == 0U && queued == 0U)
+            wait_nr = 1U;
+        if (wait_nr > in_flight)
+            wait_nr = in_flight;
+        result = itd_uring_submit_and_wait(&reader->ring, wait_nr);
+        if (result < 0) {
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(-result));
+            return result;
+        }
+
+        {
+            const unsigned int reaped = reap_completions(reader, stats);
+            in_flight -= reaped;
+            completed += reaped;
+        }
+    }
+
+    return 0;
+}
+
+int blog_run_uring_reader(const struct blog_options *const opts)
+{
+    struct uring_reader reader;
+    struct blog_stats stats;
+    struct iovec arena_iov;
+    void *arena = NULL;
+    const size_t arena_size = (size_t)opts->queue_depth * URING_SLOT_SIZE;
+    unsigned int i;
+    int result;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.special_fh = -1;
+    reader.cdev_fh = -1;
+    reader.ring.ring_fd = -1;
+
+    result = blog_stats_init(&stats, opts->reads);
+    if (result)
+        return result;
+
+    result = open_target_files(&reader, opts->target);
+    if (result)
+        goto exit_close_files;
+
+    result = itd_uring_init(&reader.ring, opts->queue_depth);
+    if (result) {
+        fprintf(stderr, "Failed to set up io_uring: %s\n", strerror(-result));
+        goto exit_close_files;
+    }
+
+    result = posix_memalign(&arena, (size_t)sysconf(_SC_PAGESIZE),
+                            arena_size);
+    reader.arena = arena;
+    reader.submit_ns = malloc(opts->queue_depth * sizeof(*reader.submit_ns));
+    reader.free_slots = malloc(opts->queue_depth * sizeof(*reader.free_slots));
+    if (result || !reader.submit_ns || !reader.free_slots) {
+        result = -ENOMEM;
+        goto exit_free;
+    }
+
+    for (i = 0U; i < opts->queue_depth; ++i)
+        reader.free_slots[reader.free_top++] = i;
+
+    arena_iov.iov_base = reader.arena;
+    arena_iov.iov_len = arena_size;
+    result = itd_uring_register_buffers(&reader.ring, &arena_iov, 1U);
+    if (result) {
+        fprintf(stderr, "Failed to register buffers: %s\n", strerror(-result));
+        goto exit_free;
+    }
+
+    itd_trace_on();
+    itd_trace_print(TAG "uring reader start: depth %u batch %u reads %lu\n",
+                    opts->queue_depth, opts->batch_size, opts->reads);
+
+    stats.start_ns = blog_now_ns();
+    result = run_batches(&reader, opts, &stats);
+    stats.end_ns = blog_now_ns();
+    stats.syscalls = reader.ring.enter_calls;
+
+    itd_trace_print(TAG "uring reader end\n");
+    itd_trace_off();
+
+    if (result == 0)
+        blog_stats_report(&stats, "io_uring reader", stdout);
+
+exit_free:
+    free(reader.free_slots);
+    free(reader.submit_ns);
+    free(reader.arena);
+    itd_uring_exit(&reader.ring);
+exit_close_files:
+    close_target_files(&reader);
+    blog_stats_free(&stats);
+    return result;
+}
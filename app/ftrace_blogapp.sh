@@ -25,6 +25,8 @@
 ## Initialise veriables.
 temporary_file=""
 debug_mode=${1:-0}
+autosize_mode=${2:-0}
+tracing_dir=/sys/kernel/debug/tracing
 
 ##
 ## Trap errors and do cleanup if script errors
@@ -57,13 +59,34 @@ echo "function_graph" > /sys/kernel/debug/tracing/current_tracer
 ## Clobber trace contents
 echo "" > /sys/kernel/debug/tracing/trace
 
+##
+## If asked to (second argument non-zero, needs make trace_autosize), run our
+## program under trace_autosize so that the ring buffers grow if they start to
+## lose events. It reports the event rate and losses per CPU to stderr
+## afterwards. Its polling would otherwise be traced too, adding overruns of
+## its own and noise to the output, so where the kernel allows (5.8+) its pid
+## is excluded. The program it runs gets a new pid and is still traced.
+run_app() {
+    if [ $autosize_mode -eq 0 ]; then
+        "$@"
+    elif [ -f $tracing_dir/set_ftrace_notrace_pid ]; then
+        sh -c 'echo $$ > "$0/set_ftrace_notrace_pid"
+               echo $$ > "$0/set_event_notrace_pid"
+               exec ./trace_autosize "$@"' $tracing_dir "$@"
+        echo "" > $tracing_dir/set_ftrace_notrace_pid
+        echo "" > $tracing_dir/set_event_notrace_pid
+    else
+        ./trace_autosize "$@"
+    fi
+}
+
 ##
 ## Turn tracing on whilst running our program, then off again afterwards
 if [ $debug_mode -ne 0 ]; then 
-    ./blog_app_debug
+    run_app ./blog_app_debug
 else 
     echo 1 > /sys/kernel/debug/tracing/tracing_on
-    ./blog_app
+    run_app ./blog_app
     echo 0 > /sys/kernel/debug/tracing/tracing_on
 fi
 
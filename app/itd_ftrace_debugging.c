@@ -29,15 +29,24 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <sys/utsname.h>
 #include <linux/limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "itd_ftrace_debugging.h"
 #include "cstrings/get_line/get_line.h"
 
 #define TRACE_BUFFER_SIZE 256U
 
-/** @brief Buffer to print trace_print() output to before sending to ftrace */
-static char trace_buffer[TRACE_BUFFER_SIZE];
+/**
+ * @brief Buffer to print trace_print() output to before sending to ftrace.
+ *        One per thread so that threads can write markers concurrently.
+ */
+static _Thread_local char trace_buffer[TRACE_BUFFER_SIZE];
 
 /** @brief Absolute path to tracefs "tracing_on" file */
 static char *tracing_on_file_path = NULL;
@@ -45,6 +54,9 @@ static char *tracing_on_file_path = NULL;
 /** @brief Absolute path to tracefs "trace_marker" file */
 static char *trace_marker_file_path = NULL;
 
+/** @brief Absolute path to the tracefs directory holding the ftrace files */
+static char *tracefs_dir_path = NULL;
+
 /** @brief file handle for tracefs "tracing_on" file */
 static int tracing_toggle_fh = -1;
 
@@ -56,7 +68,7 @@ static bool trace_is_enabled = 0;
 
 /**
  * @brief Allocate and set buffers for absolute paths to tracefs files
- *        "tracing_on" and "trace_marker"
+ *        "tracing_on" and "trace_marker" and to the tracefs directory itself
  *
  * Depending on the version of Linux, the filesystem may be debugfs or tracefs
  * If its tracefs then just take the path given, if its debugfs then we have to
@@ -69,30 +81,30 @@ static bool trace_is_enabled = 0;
  *
  * @return 0 on success or -ENOMEM if buffer allocation fails.
  *
- * @post The global pointers tracing_on_file_path and trace_marker_file_path
- *       will point to malloced string buffers on success.
+ * @post The global pointers tracing_on_file_path, trace_marker_file_path and
+ *       tracefs_dir_path will point to malloced string buffers on success.
  */
 static int allocate_and_set_tracefs_file_paths(const char *const mount_path,
                                                const bool is_tracefs)
 {
     static char **tracefs_file_paths[] = {
-        &tracing_on_file_path, &trace_marker_file_path};
+        &tracing_on_file_path, &trace_marker_file_path, &tracefs_dir_path};
     static const char *const trace_fs_file_names[] = {
-        "/tracing_on", "/trace_marker"};
-    static const size_t trace_fs_file_names_strlen[] = {11U, 13U};
+        "/tracing_on", "/trace_marker", ""};
+    static const size_t trace_fs_file_names_strlen[] = {11U, 13U, 0U};
     /* Debugfs files must include an extra subdir - make sure there's room */
     const size_t debufs_path_extention_strlen = is_tracefs ? 0U : 8U;
     const size_t mount_path_strlen = strnlen(mount_path, PATH_MAX);
     unsigned int i = 0U;
 
-    /* For each variable "tracing_on_file_path", "trace_marker_file_path": */
-    for (; i < 2U; ++i) {
+    /* For each variable "tracing_on_file_path", "trace_marker_file_path"... */
+    for (; i < 3U; ++i) {
         size_t buffer_offset = 0U;
 
         *tracefs_file_paths[i] = malloc(
             mount_path_strlen + debufs_path_extention_strlen + 
             trace_fs_file_names_strlen[i] + 1U); /* +1 for '\0' */
-        if (!tracing_on_file_path)
+        if (!*tracefs_file_paths[i])
             goto out_of_memory;
 
         strcpy(*tracefs_file_paths[i], mount_path);
@@ -109,7 +121,7 @@ static int allocate_and_set_tracefs_file_paths(const char *const mount_path,
     return 0;
 
 out_of_memory:
-    for (i = 0U; i < 2U; ++i) {
+    for (i = 0U; i < 3U; ++i) {
         free(*tracefs_file_paths[i]);
         *tracefs_file_paths[i] = NULL;
     }
@@ -224,6 +236,44 @@ static int find_tracefs(void)
     return result;
 }
 
+/**
+ * @brief Free the paths allocated by find_tracefs() so that it will search
+ *        again next time.
+ */
+static void free_tracefs_paths(void)
+{
+    free(tracing_on_file_path);
+    free(trace_marker_file_path);
+    free(tracefs_dir_path);
+    tracing_on_file_path = NULL;
+    trace_marker_file_path = NULL;
+    tracefs_dir_path = NULL;
+}
+
+/**
+ * @brief Find tracefs for an API that can be used without
+ *        itd_init_debug_tracing(). Does nothing if the library has already
+ *        found it.
+ *
+ * @return 0 on success or a negative errno value.
+ */
+static int acquire_tracefs_paths(void)
+{
+    const int result = find_tracefs();
+
+    return result > 0 ? -result : result;
+}
+
+/**
+ * @brief Undo acquire_tracefs_paths(). Paths found just for the caller are
+ *        freed, an initialised library keeps its own.
+ */
+static void release_tracefs_paths(void)
+{
+    if (tracing_toggle_fh < 0)
+        free_tracefs_paths();
+}
+
 int itd_init_debug_tracing(void)
 {
     const int result = find_tracefs();
@@ -244,23 +294,23 @@ int itd_init_debug_tracing(void)
 
 exit_no_marker:
     close(tracing_toggle_fh);
+    tracing_toggle_fh = -1;
 exit_no_toggle:
-    free(tracing_on_file_path);
-    free(trace_marker_file_path);
+    free_tracefs_paths();
 exit_no_tracefs:
     return -1;
 }
 
 void itd_trace_on(void)
 {
-    write(tracing_toggle_fh, "1", 1);
-    trace_is_enabled = true;
+    if (write(tracing_toggle_fh, "1", 1) == 1)
+        trace_is_enabled = true;
 }
 
 void itd_trace_off(void)
 {
-    write(tracing_toggle_fh, "0", 1);
-    trace_is_enabled = false;
+    if (write(tracing_toggle_fh, "0", 1) == 1)
+        trace_is_enabled = false;
 }
 
 void itd_uninit_debug_tracing(void)
@@ -270,8 +320,18 @@ void itd_uninit_debug_tracing(void)
     tracing_toggle_fh = -1;
     trace_marker_fh = -1;
     trace_is_enabled = false;
-    free(tracing_on_file_path);
-    free(trace_marker_file_path);
+    free_tracefs_paths();
+}
+
+/**
+ * @brief Write one marker to the tracefs "trace_marker" file.
+ *
+ * @return True if the whole marker was written. Markers are best effort, so
+ *         most callers carry on regardless.
+ */
+static bool write_trace_marker(const char *const marker, const size_t len)
+{
+    return write(trace_marker_fh, marker, len) == (ssize_t)len;
 }
 
 void itd_trace_print(const char *const fmt, ...)
@@ -286,10 +346,1090 @@ void itd_trace_print(const char *const fmt, ...)
     va_start(ap, fmt);
     const int count = vsnprintf(trace_buffer, TRACE_BUFFER_SIZE, fmt, ap);
     if (count > 0)
-        write(trace_marker_fh, trace_buffer, (size_t)count);
+        write_trace_marker(trace_buffer,
+                           (size_t)count < TRACE_BUFFER_SIZE
+                               ? (size_t)count
+                               : TRACE_BUFFER_SIZE - 1U);
     va_end(ap);
 
     if (!prev_trace_is_enabled) {
         itd_trace_off();
     }
 }
+
+/** @brief Payload bytes hex encoded into each itd_trace_dump() marker */
+#define DUMP_CHUNK_SIZE 96U
+
+/**
+ * @brief Hex encode `len` bytes of `src` into `dst`, which must have room for
+ *        2 * len characters. No '\0' is written.
+ *
+ * The cost is fixed per byte: there are no data dependent branches. With SSE2
+ * (always present on x86-64) 16 bytes are encoded per iteration, each nibble
+ * being turned into '0'-'9' or 'a'-'f' with a compare-and-mask rather than a
+ * table lookup, and the nibbles interleaved back into byte order.
+ */
+static void hex_encode(char *dst, const unsigned char *src, size_t len)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+#ifdef __SSE2__
+    const __m128i low_nibble_mask = _mm_set1_epi8(0x0f);
+    const __m128i ascii_zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i letter_offset = _mm_set1_epi8('a' - '0' - 10);
+
+    for (; len >= 16U; len -= 16U, src += 16U, dst += 32U) {
+        const __m128i bytes = _mm_loadu_si128((const __m128i *)(const void *)src);
+        /* There is no 8-bit shift, but masking drops the bits shifted across */
+        const __m128i high =
+            _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble_mask);
+        const __m128i low = _mm_and_si128(bytes, low_nibble_mask);
+        const __m128i high_chars = _mm_add_epi8(
+            _mm_add_epi8(high, ascii_zero),
+            _mm_and_si128(_mm_cmpgt_epi8(high, nine), letter_offset));
+        const __m128i low_chars = _mm_add_epi8(
+            _mm_add_epi8(low, ascii_zero),
+            _mm_and_si128(_mm_cmpgt_epi8(low, nine), letter_offset));
+
+        _mm_storeu_si128((__m128i *)(void *)dst,
+                         _mm_unpacklo_epi8(high_chars, low_chars));
+        _mm_storeu_si128((__m128i *)(void *)(dst + 16),
+                         _mm_unpackhi_epi8(high_chars, low_chars));
+    }
+#endif
+
+    for (; len > 0U; --len, ++src) {
+        *dst++ = hex_digits[*src >> 4];
+        *dst++ = hex_digits[*src & 0x0fU];
+    }
+}
+
+/** @brief Identifies the markers that belong to one itd_trace_dump() call */
+static unsigned int dump_sequence = 0U;
+
+void itd_trace_dump(const char *const tag, const void *const buf,
+                    const size_t len)
+{
+    const bool prev_trace_is_enabled = trace_is_enabled;
+    const unsigned char *const bytes = buf;
+    const unsigned int dump_no =
+        __atomic_fetch_add(&dump_sequence, 1U, __ATOMIC_RELAXED);
+    const size_t chunks = len ? (len + DUMP_CHUNK_SIZE - 1U) / DUMP_CHUNK_SIZE
+                              : 1U;
+    size_t chunk = 0U;
+
+    if (!prev_trace_is_enabled) {
+        itd_trace_on();
+    }
+
+    for (; chunk < chunks; ++chunk) {
+        const size_t offset = chunk * DUMP_CHUNK_SIZE;
+        const size_t chunk_len =
+            len - offset < DUMP_CHUNK_SIZE ? len - offset : DUMP_CHUNK_SIZE;
+        /*
+         * Leave room for a full chunk of hex and the '\n'. A tag too long
+         * for what is left is truncated so the sequence fields always survive.
+         */
+        const int suffix_len = snprintf(NULL, 0, " dump %u %zu/%zu: ",
+                                        dump_no, chunk + 1U, chunks);
+        const int tag_width =
+            (int)(TRACE_BUFFER_SIZE - 2U * DUMP_CHUNK_SIZE - 2U) - suffix_len;
+        int count;
+
+        if (suffix_len < 0 || tag_width < 0)
+            break;
+
+        count = snprintf(trace_buffer, TRACE_BUFFER_SIZE,
+                         "%.*s dump %u %zu/%zu: ", tag_width, tag, dump_no,
+                         chunk + 1U, chunks);
+        if (count < 0)
+            break;
+
+        hex_encode(trace_buffer + count, bytes + offset, chunk_len);
+        count += (int)(2U * chunk_len);
+        trace_buffer[count++] = '\n';
+        if (!write_trace_marker(trace_buffer, (size_t)count))
+            break;
+    }
+
+    if (!prev_trace_is_enabled) {
+        itd_trace_off();
+    }
+}
+
+/** @brief Longest command written to a tracefs control file */
+#define TRACEFS_COMMAND_SIZE 512U
+
+/**
+ * @brief Open a file in the tracefs directory.
+ *
+ * @param rel_path Path of the file relative to the tracefs directory.
+ * @param flags    Flags for open().
+ *
+ * @return File handle or a negative errno value on failure.
+ */
+static int open_tracefs_file(const char *const rel_path, const int flags)
+{
+    char path[PATH_MAX];
+    int fh;
+
+    if (!tracefs_dir_path)
+        return -ENODEV;
+
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", tracefs_dir_path,
+                         rel_path) >= sizeof(path))
+        return -ENAMETOOLONG;
+
+    fh = open(path, flags);
+    return fh < 0 ? -errno : fh;
+}
+
+/**
+ * @brief Write a null terminated string to a tracefs file.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+static int write_tracefs_file(const char *const rel_path,
+                              const char *const data, const int flags)
+{
+    const int fh = open_tracefs_file(rel_path, O_WRONLY | flags);
+    int result = 0;
+
+    if (fh < 0)
+        return fh;
+
+    if (write(fh, data, strlen(data)) < 0)
+        result = -errno;
+
+    close(fh);
+    return result;
+}
+
+/**
+ * @brief Read a tracefs file into `buf` as a null terminated string,
+ *        truncating it if `buf` is too small.
+ *
+ * @return Number of bytes read, excluding the '\0', or a negative errno
+ *         value on failure.
+ */
+static ssize_t read_tracefs_file(const char *const rel_path, char *const buf,
+                                 const size_t size)
+{
+    size_t total = 0U;
+    int fh;
+
+    if (size == 0U)
+        return -EINVAL;
+
+    fh = open_tracefs_file(rel_path, O_RDONLY);
+    if (fh < 0)
+        return fh;
+
+    while (total < size - 1U) {
+        const ssize_t bytes_read = read(fh, buf + total, size - 1U - total);
+
+        if (bytes_read < 0) {
+            const int error = errno;
+            close(fh);
+            return -error;
+        }
+        if (bytes_read == 0)
+            break;
+        total += (size_t)bytes_read;
+    }
+
+    buf[total] = '\0';
+    close(fh);
+    return (ssize_t)total;
+}
+
+/**
+ * @brief Append a command to a tracefs control file such as
+ *        "synthetic_events" or "events/<system>/<event>/trigger".
+ *
+ * Control files are opened with O_APPEND: opening them with O_TRUNC would
+ * remove every definition already made in them, including other users'.
+ *
+ * @param rel_path Path of the file relative to the tracefs directory.
+ * @param command  Null terminated command to write.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+static int write_tracefs_command(const char *const rel_path,
+                                 const char *const command)
+{
+    return write_tracefs_file(rel_path, command, O_APPEND);
+}
+
+/**
+ * @brief Format a command into `command` and check it was not truncated.
+ *
+ * @return 0 on success or -E2BIG if the command does not fit.
+ */
+static int format_command(char *const command, const char *const fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int format_command(char *const command, const char *const fmt, ...)
+{
+    va_list ap;
+    int count;
+
+    va_start(ap, fmt);
+    count = vsnprintf(command, TRACEFS_COMMAND_SIZE, fmt, ap);
+    va_end(ap);
+
+    if (count < 0 || (size_t)count >= TRACEFS_COMMAND_SIZE)
+        return -E2BIG;
+
+    return 0;
+}
+
+/**
+ * @brief Add or, when `remove` is true, remove a trigger of an event given
+ *        as "system/event".
+ */
+static int write_event_trigger(const char *const event, const bool remove,
+                               const char *const trigger,
+                               const char *const filter)
+{
+    char path[TRACEFS_COMMAND_SIZE];
+    char command[TRACEFS_COMMAND_SIZE];
+    int result;
+
+    result = format_command(path, "events/%s/trigger", event);
+    if (result)
+        return result;
+
+    result = format_command(command, "%s%s%s%s", remove ? "!" : "", trigger,
+                            filter ? " if " : "", filter ? filter : "");
+    if (result)
+        return result;
+
+    return write_tracefs_command(path, command);
+}
+
+/**
+ * @brief The hist triggers, in the order they must be created. They are
+ *        removed in the reverse order as later ones refer to earlier ones.
+ */
+enum latency_hist_trigger {
+    LATENCY_HIST_START,
+    LATENCY_HIST_END,
+    LATENCY_HIST_SYNTH,
+    LATENCY_HIST_NUM_TRIGGERS
+};
+
+/**
+ * @brief Build the event, trigger and filter for one of a latency
+ *        histogram's hist triggers.
+ */
+static int format_latency_hist_trigger(const struct itd_latency_hist *const hist,
+                                       const enum latency_hist_trigger which,
+                                       char *const event, char *const trigger,
+                                       const char **const filter)
+{
+    char start_event[TRACEFS_COMMAND_SIZE];
+    char *separator;
+    int result;
+
+    switch (which) {
+    case LATENCY_HIST_START:
+        *filter = hist->start_filter;
+        result = format_command(event, "%s", hist->start_event);
+        if (result)
+            return result;
+        return format_command(trigger,
+                              "hist:keys=common_pid:%s_ts=common_timestamp",
+                              hist->name);
+
+    case LATENCY_HIST_END:
+        /* onmatch() names the start event as "system.event" */
+        result = format_command(start_event, "%s", hist->start_event);
+        if (result)
+            return result;
+        separator = strchr(start_event, '/');
+        if (!separator)
+            return -EINVAL;
+        *separator = '.';
+
+        *filter = hist->end_filter;
+        result = format_command(event, "%s", hist->end_event);
+        if (result)
+            return result;
+        return format_command(trigger,
+                              "hist:keys=common_pid:"
+                              "%s_lat=common_timestamp-$%s_ts:"
+                              "onmatch(%s).%s($%s_lat,common_pid)",
+                              hist->name, hist->name, start_event, hist->name,
+                              hist->name);
+
+    case LATENCY_HIST_SYNTH:
+        *filter = NULL;
+        result = format_command(event, "synthetic/%s", hist->name);
+        if (result)
+            return result;
+        return format_command(trigger, "hist:keys=lat_ns.log2:sort=lat_ns");
+
+    default:
+        return -EINVAL;
+    }
+}
+
+int itd_kprobe_create(const char *const event, const char *const symbol)
+{
+    char command[TRACEFS_COMMAND_SIZE];
+    const int result = format_command(command, "p:%s %s", event, symbol);
+
+    return result ? result : write_tracefs_command("kprobe_events", command);
+}
+
+void itd_kprobe_destroy(const char *const event)
+{
+    char command[TRACEFS_COMMAND_SIZE];
+
+    if (format_command(command, "-:%s", event) == 0)
+        write_tracefs_command("kprobe_events", command);
+}
+
+int itd_latency_hist_create(const struct itd_latency_hist *const hist)
+{
+    char command[TRACEFS_COMMAND_SIZE];
+    char event[TRACEFS_COMMAND_SIZE];
+    const char *filter;
+    unsigned int created = 0U;
+    int result;
+
+    result = format_command(command, "%s u64 lat_ns; pid_t pid", hist->name);
+    if (result)
+        return result;
+
+    result = write_tracefs_command("synthetic_events", command);
+    if (result)
+        return result;
+
+    for (; created < LATENCY_HIST_NUM_TRIGGERS; ++created) {
+        result = format_latency_hist_trigger(
+            hist, (enum latency_hist_trigger)created, event, command, &filter);
+        if (result == 0)
+            result = write_event_trigger(event, false, command, filter);
+        if (result)
+            goto exit_remove_triggers;
+    }
+
+    return 0;
+
+exit_remove_triggers:
+    while (created-- > 0U) {
+        if (format_latency_hist_trigger(
+                hist, (enum latency_hist_trigger)created, event, command,
+                &filter) == 0)
+            write_event_trigger(event, true, command, filter);
+    }
+    if (format_command(command, "!%s", hist->name) == 0)
+        write_tracefs_command("synthetic_events", command);
+    return result;
+}
+
+ssize_t itd_latency_hist_read(const struct itd_latency_hist *const hist,
+                              char *const buf, const size_t size)
+{
+    char path[TRACEFS_COMMAND_SIZE];
+    const int result =
+        format_command(path, "events/synthetic/%s/hist", hist->name);
+
+    return result ? result : read_tracefs_file(path, buf, size);
+}
+
+void itd_latency_hist_destroy(const struct itd_latency_hist *const hist)
+{
+    char command[TRACEFS_COMMAND_SIZE];
+    char event[TRACEFS_COMMAND_SIZE];
+    const char *filter;
+    unsigned int i = LATENCY_HIST_NUM_TRIGGERS;
+
+    while (i-- > 0U) {
+        if (format_latency_hist_trigger(hist, (enum latency_hist_trigger)i,
+                                        event, command, &filter) == 0)
+            write_event_trigger(event, true, command, filter);
+    }
+
+    if (format_command(command, "!%s", hist->name) == 0)
+        write_tracefs_command("synthetic_events", command);
+}
+
+/** @brief Big enough for a per_cpu/cpuN/stats file */
+#define CPU_STATS_FILE_SIZE 1024U
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Difference between two readings of a counter. The kernel resets the
+ *        counters when the trace is cleared, in which case the whole of the
+ *        newer reading is new.
+ */
+static unsigned long long counter_delta(const unsigned long long now,
+                                        const unsigned long long then)
+{
+    return now >= then ? now - then : now;
+}
+
+/**
+ * @brief Parse the "key: value" lines of a per_cpu/cpuN/stats file. Keys that
+ *        are not counters we use, such as "oldest event ts", are ignored.
+ */
+static void parse_cpu_stats(char *const text,
+                            struct itd_cpu_buffer_stats *const stats)
+{
+    static const struct {
+        const char *key;
+        size_t offset;
+    } counters[] = {
+        {"entries", offsetof(struct itd_cpu_buffer_stats, entries)},
+        {"overrun", offsetof(struct itd_cpu_buffer_stats, overrun)},
+        {"commit overrun",
+         offsetof(struct itd_cpu_buffer_stats, commit_overrun)},
+        {"bytes", offsetof(struct itd_cpu_buffer_stats, bytes)},
+        {"dropped events",
+         offsetof(struct itd_cpu_buffer_stats, dropped_events)},
+        {"read events", offsetof(struct itd_cpu_buffer_stats, read_events)},
+    };
+    char *saveptr = NULL;
+    char *line;
+
+    for (line = strtok_r(text, "\n", &saveptr); line;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+        char *const colon = strchr(line, ':');
+        size_t i;
+
+        if (!colon)
+            continue;
+        *colon = '\0';
+
+        for (i = 0U; i < sizeof(counters) / sizeof(counters[0]); ++i) {
+            if (strcmp(line, counters[i].key) == 0) {
+                *(unsigned long long *)(void *)((char *)stats +
+                                                counters[i].offset) =
+                    strtoull(colon + 1, NULL, 10);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Read one CPU's ring buffer counters and size.
+ *
+ * @return 0 on success or a negative errno value, -ENOENT if the CPU has no
+ *         tracefs entry.
+ */
+static int read_cpu_buffer_stats(const unsigned int cpu,
+                                 struct itd_cpu_buffer_stats *const stats)
+{
+    char path[TRACEFS_COMMAND_SIZE];
+    char text[CPU_STATS_FILE_SIZE];
+    const char *expanded;
+    ssize_t result;
+
+    memset(stats, 0, sizeof(*stats));
+
+    result = format_command(path, "per_cpu/cpu%u/stats", cpu);
+    if (result == 0)
+        result = read_tracefs_file(path, text, sizeof(text));
+    if (result < 0)
+        return (int)result;
+    parse_cpu_stats(text, stats);
+
+    result = format_command(path, "per_cpu/cpu%u/buffer_size_kb", cpu);
+    if (result == 0)
+        result = read_tracefs_file(path, text, sizeof(text));
+    if (result < 0)
+        return (int)result;
+
+    /* Until first used the buffers read as e.g. "7 (expanded: 1408)" */
+    expanded = strstr(text, "expanded:");
+    stats->size_kb = strtoul(expanded ? expanded + 9 : text, NULL, 10);
+
+    return 0;
+}
+
+int itd_buffer_autosize_init(struct itd_buffer_autosize *const autosize,
+                             const unsigned long budget_kb)
+{
+    const long nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned int cpu;
+    int result;
+
+    memset(autosize, 0, sizeof(*autosize));
+    if (nr_cpus <= 0)
+        return -EINVAL;
+
+    result = acquire_tracefs_paths();
+    if (result)
+        return result;
+
+    autosize->nr_cpus = (unsigned int)nr_cpus;
+    autosize->budget_kb = budget_kb;
+    autosize->first = calloc(autosize->nr_cpus, sizeof(*autosize->first));
+    autosize->last = calloc(autosize->nr_cpus, sizeof(*autosize->last));
+    autosize->grown = calloc(autosize->nr_cpus, sizeof(*autosize->grown));
+    autosize->online = calloc(autosize->nr_cpus, sizeof(*autosize->online));
+    if (!autosize->first || !autosize->last || !autosize->grown ||
+        !autosize->online) {
+        itd_buffer_autosize_free(autosize);
+        return -ENOMEM;
+    }
+
+    for (cpu = 0U; cpu < autosize->nr_cpus; ++cpu) {
+        result = read_cpu_buffer_stats(cpu, &autosize->first[cpu]);
+        if (result == -ENOENT)
+            continue;
+        if (result) {
+            itd_buffer_autosize_free(autosize);
+            return result;
+        }
+        autosize->online[cpu] = true;
+        autosize->last[cpu] = autosize->first[cpu];
+    }
+
+    autosize->start_ns = monotonic_ns();
+    autosize->last_ns = autosize->start_ns;
+    return 0;
+}
+
+int itd_buffer_autosize_poll(struct itd_buffer_autosize *const autosize)
+{
+    unsigned long total_kb = 0U;
+    unsigned int cpu;
+    int grown = 0;
+
+    for (cpu = 0U; cpu < autosize->nr_cpus; ++cpu)
+        if (autosize->online[cpu])
+            total_kb += autosize->last[cpu].size_kb;
+
+    for (cpu = 0U; cpu < autosize->nr_cpus; ++cpu) {
+        struct itd_cpu_buffer_stats now;
+        unsigned long long lost;
+        int result;
+
+        if (!autosize->online[cpu])
+            continue;
+
+        result = read_cpu_buffer_stats(cpu, &now);
+        if (result)
+            return result;
+
+        lost = counter_delta(now.overrun, autosize->last[cpu].overrun) +
+               counter_delta(now.dropped_events,
+                             autosize->last[cpu].dropped_events);
+
+        if (lost && total_kb < autosize->budget_kb && now.size_kb) {
+            const unsigned long headroom_kb = autosize->budget_kb - total_kb;
+            const unsigned long grow_kb =
+                now.size_kb < headroom_kb ? now.size_kb : headroom_kb;
+            char path[TRACEFS_COMMAND_SIZE];
+            char size[32];
+
+            result = format_command(path, "per_cpu/cpu%u/buffer_size_kb",
+                                    cpu);
+            if (result)
+                return result;
+            snprintf(size, sizeof(size), "%lu", now.size_kb + grow_kb);
+
+            /* Not fatal - the kernel may refuse if memory is short */
+            if (write_tracefs_file(path, size, O_TRUNC) == 0) {
+                now.size_kb += grow_kb;
+                total_kb += grow_kb;
+                ++autosize->grown[cpu];
+                ++grown;
+            }
+        }
+
+        autosize->last[cpu] = now;
+    }
+
+    autosize->last_ns = monotonic_ns();
+    return grown;
+}
+
+void itd_buffer_autosize_report(const struct itd_buffer_autosize *const autosize,
+                                FILE *const out)
+{
+    const double elapsed_s =
+        (double)(autosize->last_ns - autosize->start_ns) / 1e9;
+    unsigned long long total_events = 0U;
+    unsigned long long total_lost = 0U;
+    unsigned int cpu;
+
+    fprintf(out, "%4s %10s %6s %12s %12s %10s %7s\n", "cpu", "size_kb",
+            "grown", "events", "events/s", "lost", "lost%");
+
+    for (cpu = 0U; cpu < autosize->nr_cpus; ++cpu) {
+        const struct itd_cpu_buffer_stats *const first = &autosize->first[cpu];
+        const struct itd_cpu_buffer_stats *const last = &autosize->last[cpu];
+        unsigned long long lost;
+        unsigned long long events;
+
+        if (!autosize->online[cpu])
+            continue;
+
+        lost = counter_delta(last->overrun, first->overrun) +
+               counter_delta(last->dropped_events, first->dropped_events);
+        /*
+         * Every event is still in the buffer, read, overwritten or dropped.
+         * entries + read_events alone falls as events are overwritten, but
+         * with overrun added it only ever grows.
+         */
+        events = counter_delta(
+                     last->entries + last->read_events + last->overrun,
+                     first->entries + first->read_events + first->overrun) +
+                 counter_delta(last->dropped_events, first->dropped_events);
+        total_events += events;
+        total_lost += lost;
+
+        fprintf(out, "%4u %10lu %6u %12llu %12.0f %10llu %6.2f%%\n", cpu,
+                last->size_kb, autosize->grown[cpu], events,
+                elapsed_s > 0.0 ? (double)events / elapsed_s : 0.0, lost,
+                events ? 100.0 * (double)lost / (double)events : 0.0);
+    }
+
+    fprintf(out, "%4s %10s %6s %12llu %12.0f %10llu %6.2f%%\n", "all", "",
+            "", total_events,
+            elapsed_s > 0.0 ? (double)total_events / elapsed_s : 0.0,
+            total_lost,
+            total_events ? 100.0 * (double)total_lost / (double)total_events
+                         : 0.0);
+}
+
+void itd_buffer_autosize_free(struct itd_buffer_autosize *const autosize)
+{
+    free(autosize->first);
+    free(autosize->last);
+    free(autosize->grown);
+    free(autosize->online);
+    autosize->first = NULL;
+    autosize->last = NULL;
+    autosize->grown = NULL;
+    autosize->online = NULL;
+
+    release_tracefs_paths();
+}
+
+/** @brief Size of the buffer filter tokens are written from */
+#define FILTER_WRITE_SIZE (64U * 1024U)
+
+/** @brief Marks the end of a hash chain in a function_index */
+#define NO_FUNCTION ((size_t)-1)
+
+/**
+ * @brief One line of available_filter_functions, e.g.
+ *        "itdev_example_cdev_read [most_basic]".
+ */
+struct function_entry {
+    char *name;                 /*< Owns the line buffer */
+    const char *module;         /*< Points into it, NULL for built in code */
+    size_t next;                /*< Next entry in the same hash bucket */
+    bool selected;
+};
+
+/**
+ * @brief available_filter_functions held in memory. An entry's position in
+ *        `entries` is its index in the file less one.
+ */
+struct function_index {
+    struct function_entry *entries;
+    size_t count;
+    size_t capacity;
+    size_t *buckets;            /*< Heads of the hash chains */
+    size_t nr_buckets;          /*< Power of two */
+};
+
+/* FNV-1a */
+static size_t hash_function_name(const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *name; ++name) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static void free_function_index(struct function_index *const index)
+{
+    size_t i;
+
+    for (i = 0U; i < index->count; ++i)
+        free(index->entries[i].name);
+    free(index->entries);
+    free(index->buckets);
+    memset(index, 0, sizeof(*index));
+}
+
+/**
+ * @brief Split a line into a function name and optional "[module]" in place
+ *        and append it to the index.
+ *
+ * @post The index owns `line` on success.
+ */
+static int add_function_entry(struct function_index *const index,
+                              char *const line)
+{
+    struct function_entry *entry;
+    char *saveptr = NULL;
+    char *module;
+
+    if (index->count == index->capacity) {
+        const size_t new_capacity =
+            index->capacity ? 2U * index->capacity : 4096U;
+        struct function_entry *const new_entries = realloc(
+            index->entries, new_capacity * sizeof(*new_entries));
+
+        if (!new_entries)
+            return -ENOMEM;
+        index->entries = new_entries;
+        index->capacity = new_capacity;
+    }
+
+    entry = &index->entries[index->count++];
+    entry->name = line;
+    entry->module = NULL;
+    entry->next = NO_FUNCTION;
+    entry->selected = false;
+
+    /* An empty name still takes up an index so the numbering stays right */
+    if (!strtok_r(line, " \t\r\n", &saveptr))
+        line[0] = '\0';
+    module = strtok_r(NULL, " \t\r\n", &saveptr);
+    if (module && module[0] == '[') {
+        module[strcspn(module, "]")] = '\0';
+        entry->module = module + 1;
+    }
+
+    return 0;
+}
+
+static int build_function_hash(struct function_index *const index)
+{
+    size_t i;
+
+    index->nr_buckets = 1024U;
+    while (index->nr_buckets < 2U * index->count)
+        index->nr_buckets *= 2U;
+
+    index->buckets = malloc(index->nr_buckets * sizeof(*index->buckets));
+    if (!index->buckets)
+        return -ENOMEM;
+    for (i = 0U; i < index->nr_buckets; ++i)
+        index->buckets[i] = NO_FUNCTION;
+
+    for (i = 0U; i < index->count; ++i) {
+        const size_t bucket = hash_function_name(index->entries[i].name) &
+                              (index->nr_buckets - 1U);
+
+        index->entries[i].next = index->buckets[bucket];
+        index->buckets[bucket] = i;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read available_filter_functions into a hashed, in-memory index.
+ */
+static int load_function_index(struct function_index *const index)
+{
+    char *line = NULL;
+    size_t buff_size = 0;
+    FILE *functions_fh;
+    int result = 0;
+    int fh;
+
+    memset(index, 0, sizeof(*index));
+
+    fh = open_tracefs_file("available_filter_functions", O_RDONLY);
+    if (fh < 0)
+        return fh;
+
+    functions_fh = fdopen(fh, "r");
+    if (!functions_fh) {
+        result = -errno;
+        close(fh);
+        return result;
+    }
+
+    while (1) {
+        result = read_line(functions_fh, &line, &buff_size);
+        if (result < 0 || line == NULL)
+            break;
+
+        result = add_function_entry(index, line);
+        if (result) {
+            free(line);
+            break;
+        }
+        line = NULL;
+    }
+
+    fclose(functions_fh);
+
+    if (result == 0)
+        result = build_function_hash(index);
+    if (result)
+        free_function_index(index);
+
+    return result;
+}
+
+/**
+ * @brief Mark every function matching one pattern as selected.
+ *
+ * @return Number of functions matched, including already selected ones.
+ */
+static size_t select_functions(struct function_index *const index,
+                               const char *const pattern)
+{
+    char glob[TRACEFS_COMMAND_SIZE];
+    const char *module = NULL;
+    char *mod_separator;
+    size_t matched = 0U;
+    size_t i;
+
+    if (format_command(glob, "%s", pattern))
+        return 0U;
+
+    mod_separator = strstr(glob, ":mod:");
+    if (mod_separator) {
+        *mod_separator = '\0';
+        module = mod_separator + 5;
+    }
+    if (glob[0] == '\0')
+        strcpy(glob, "*");
+
+    if (strpbrk(glob, "*?[") == NULL) {
+        /* A plain name - only its hash chain need be looked at */
+        const size_t bucket =
+            hash_function_name(glob) & (index->nr_buckets - 1U);
+
+        for (i = index->buckets[bucket]; i != NO_FUNCTION;
+             i = index->entries[i].next) {
+            struct function_entry *const entry = &index->entries[i];
+
+            if (strcmp(entry->name, glob) == 0 &&
+                (!module || (entry->module &&
+                             fnmatch(module, entry->module, 0) == 0))) {
+                entry->selected = true;
+                ++matched;
+            }
+        }
+
+        return matched;
+    }
+
+    for (i = 0U; i < index->count; ++i) {
+        struct function_entry *const entry = &index->entries[i];
+
+        if (fnmatch(glob, entry->name, 0) == 0 &&
+            (!module ||
+             (entry->module && fnmatch(module, entry->module, 0) == 0))) {
+            entry->selected = true;
+            ++matched;
+        }
+    }
+
+    return matched;
+}
+
+/**
+ * @brief Write a buffer of filter tokens in full. The kernel parses a single
+ *        token per write() and returns only the bytes of that token, so keep
+ *        going from wherever it stopped.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+static int write_filter_tokens(const int fh, const char *buf, size_t len,
+                               struct itd_filter_stats *const stats)
+{
+    while (len) {
+        const ssize_t written = write(fh, buf, len);
+
+        ++stats->writes;
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (written == 0)
+            return -EIO;
+
+        buf += written;
+        len -= (size_t)written;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write every selected function to an open filter file, one token
+ *        per line, through a buffer of up to FILTER_WRITE_SIZE bytes.
+ *
+ * By name with `qualify_modules`, functions in modules are written as
+ * "name:mod:module" so that only the selected copy is enabled. There is no
+ * such qualifier for built in code, and the graph filter files accept none at
+ * all, so otherwise a name enables every function sharing it.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+static int write_selected_functions(const int fh,
+                                    const struct function_index *const index,
+                                    const bool use_indexes,
+                                    const bool qualify_modules,
+                                    struct itd_filter_stats *const stats)
+{
+    char *const buffer = malloc(FILTER_WRITE_SIZE);
+    size_t used = 0U;
+    size_t i;
+    int result = 0;
+
+    if (!buffer)
+        return -ENOMEM;
+
+    for (i = 0U; i <= index->count && result == 0; ++i) {
+        char token[TRACEFS_COMMAND_SIZE];
+        size_t token_len = 0U;
+
+        if (i < index->count) {
+            if (!index->entries[i].selected)
+                continue;
+            /* Indexes in available_filter_functions start from 1 */
+            if (use_indexes)
+                token_len = (size_t)snprintf(token, sizeof(token), "%zu\n",
+                                             i + 1U);
+            else if (index->entries[i].name[0] == '\0')
+                continue;
+            else if (qualify_modules && index->entries[i].module)
+                token_len = (size_t)snprintf(token, sizeof(token),
+                                             "%s:mod:%s\n",
+                                             index->entries[i].name,
+                                             index->entries[i].module);
+            else
+                token_len = (size_t)snprintf(token, sizeof(token), "%s\n",
+                                             index->entries[i].name);
+            if (token_len >= sizeof(token))
+                continue;
+        }
+
+        /* Flush when full, and once more after the last function */
+        if (used && (i == index->count || used + token_len > FILTER_WRITE_SIZE)) {
+            result = write_filter_tokens(fh, buffer, used, stats);
+            used = 0U;
+        }
+
+        memcpy(buffer + used, token, token_len);
+        used += token_len;
+    }
+
+    free(buffer);
+    return result;
+}
+
+/**
+ * @brief Whether this is one of the function tracer's own filter files. These
+ *        accept ":mod:" qualifiers and, on Linux 5.3 onwards, function
+ *        indexes. set_graph_function and set_graph_notrace take neither.
+ */
+static bool is_ftrace_filter_file(const char *const filter_file)
+{
+    return strcmp(filter_file, "set_ftrace_filter") == 0 ||
+           strcmp(filter_file, "set_ftrace_notrace") == 0;
+}
+
+/**
+ * @brief Whether the running kernel (5.3 onwards) takes function indexes.
+ *
+ * Found from the kernel version rather than by trying an index: a rejected
+ * write to a truncated filter file would still install the emptied filter.
+ */
+static bool kernel_takes_indexes(void)
+{
+    struct utsname name;
+    unsigned int major;
+    unsigned int minor;
+
+    if (uname(&name) ||
+        sscanf(name.release, "%u.%u", &major, &minor) != 2)
+        return false;
+
+    return major > 5U || (major == 5U && minor >= 3U);
+}
+
+int itd_set_function_filter(const char *const filter_file,
+                            const char *const *const patterns,
+                            const size_t nr_patterns, const bool append,
+                            struct itd_filter_stats *const stats)
+{
+    struct itd_filter_stats local_stats;
+    struct itd_filter_stats *const out = stats ? stats : &local_stats;
+    struct function_index index;
+    uint64_t start_ns = monotonic_ns();
+    const bool ftrace_filter_file = is_ftrace_filter_file(filter_file);
+    const bool use_indexes = ftrace_filter_file && kernel_takes_indexes();
+    size_t i;
+    int result;
+    int fh;
+
+    memset(out, 0, sizeof(*out));
+
+    result = acquire_tracefs_paths();
+    if (result)
+        return result;
+
+    result = load_function_index(&index);
+    if (result)
+        goto exit_free_paths;
+    out->functions_indexed = index.count;
+    out->load_ns = monotonic_ns() - start_ns;
+
+    start_ns = monotonic_ns();
+    for (i = 0U; i < nr_patterns; ++i)
+        if (select_functions(&index, patterns[i]) == 0U)
+            ++out->unmatched_patterns;
+    for (i = 0U; i < index.count; ++i)
+        if (index.entries[i].selected)
+            ++out->functions_matched;
+    out->resolve_ns = monotonic_ns() - start_ns;
+
+    if (out->functions_matched == 0U) {
+        result = -ENOENT;
+        goto exit_free_index;
+    }
+
+    start_ns = monotonic_ns();
+    fh = open_tracefs_file(filter_file,
+                           O_WRONLY | (append ? O_APPEND : O_TRUNC));
+    if (fh < 0) {
+        result = fh;
+        goto exit_free_index;
+    }
+
+    /* The kernel installs whatever was written when the file is closed */
+    result = write_selected_functions(fh, &index, use_indexes,
+                                      ftrace_filter_file, out);
+    close(fh);
+    out->used_indexes = use_indexes;
+    out->apply_ns = monotonic_ns() - start_ns;
+
+exit_free_index:
+    free_function_index(&index);
+exit_free_paths:
+    release_tracefs_paths();
+    return result;
+}
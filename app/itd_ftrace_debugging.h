@@ -18,6 +18,35 @@
 #ifndef ITD_FTRACE_DEBUGGING_H
 #define ITD_FTRACE_DEBUGGING_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * @brief Describes a latency histogram that the kernel builds itself from a
+ *        pair of trace events, using a synthetic event and hist triggers.
+ *
+ * Whenever `start_event` fires its timestamp is saved against the current
+ * pid. When `end_event` next fires in the same pid, the time since the start
+ * is emitted as the synthetic event `name`, whose log2 histogram can then be
+ * read back with itd_latency_hist_read(). Only the histogram, a few KB, has
+ * to leave the kernel rather than a full function_graph trace.
+ *
+ * Events are given as "system/event", e.g. "raw_syscalls/sys_enter",
+ * "ftrace/print" for trace markers written by itd_trace_print() or a probe
+ * made by itd_kprobe_create(). Filters use the tracefs filter syntax, e.g.
+ * `buf ~ "*Reading special file*"`, and may be NULL.
+ */
+struct itd_latency_hist {
+    const char *name;           /*< Synthetic event name, a C identifier */
+    const char *start_event;
+    const char *start_filter;
+    const char *end_event;
+    const char *end_filter;
+};
+
 /**
  * @brief Initialise the ftrace debugging library. Function must only be called
  *        once.
@@ -56,8 +85,187 @@ void itd_trace_off(void);
  * temporarily enabled whilst the marker is written and then disabled after.
  * If tracing is already enable the marker is just written and tracing
  * remains enabled.
+ *
+ * May be called from several threads at once, but tracing should then be
+ * enabled with itd_trace_on() beforehand so that the threads do not toggle it
+ * under each other.
  */
 void itd_trace_print(const char *const fmt, ...)
     __attribute__((format(printf, 1, 2)));
 
+/**
+ * @brief Output a binary buffer as hex encoded trace markers
+ *
+ * Large buffers are split across several markers of the form
+ * "<tag> dump <n> <chunk>/<chunks>: <hex>", where <n> is the same for every
+ * marker of one call, so the payload can be put back together from the
+ * trace. Encoding is vectorised where possible and costs the same for every
+ * byte. Tracing is temporarily enabled in the same way as itd_trace_print().
+ */
+void itd_trace_dump(const char *const tag, const void *const buf,
+                    const size_t len);
+
+/**
+ * @brief Create a kprobe event, e.g. on a driver function, so that it can be
+ *        used as a start or end event of an itd_latency_hist.
+ *
+ * @param event  Event name as "group/event", e.g. "itd/read_special".
+ * @param symbol Kernel symbol to probe.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ *
+ * @pre itd_init_debug_tracing() has succeeded.
+ */
+int itd_kprobe_create(const char *const event, const char *const symbol);
+
+/**
+ * @brief Remove a kprobe event made by itd_kprobe_create(). Any triggers on
+ *        it must have been removed first.
+ */
+void itd_kprobe_destroy(const char *const event);
+
+/**
+ * @brief Create the synthetic event and hist triggers described by `hist`.
+ *        Partially created state is removed again on failure.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ *
+ * @pre itd_init_debug_tracing() has succeeded.
+ */
+int itd_latency_hist_create(const struct itd_latency_hist *const hist);
+
+/**
+ * @brief Read the kernel's histogram of latencies, in trace clock
+ *        nanoseconds, into `buf` as a null terminated string.
+ *
+ * @return Number of bytes read, excluding the '\0', or a negative errno
+ *         value on failure. The histogram is truncated if `buf` is too small.
+ */
+ssize_t itd_latency_hist_read(const struct itd_latency_hist *const hist,
+                              char *const buf, const size_t size);
+
+/**
+ * @brief Remove the hist triggers and synthetic event made by
+ *        itd_latency_hist_create().
+ */
+void itd_latency_hist_destroy(const struct itd_latency_hist *const hist);
+
+/**
+ * @brief Counters from one CPU's tracefs "per_cpu/cpuN/stats" file, plus the
+ *        size of that CPU's ring buffer.
+ */
+struct itd_cpu_buffer_stats {
+    unsigned long long entries;         /*< Events currently in the buffer */
+    unsigned long long overrun;         /*< Events overwritten, i.e. lost */
+    unsigned long long commit_overrun;
+    unsigned long long bytes;
+    unsigned long long dropped_events;  /*< Events dropped, buffer full */
+    unsigned long long read_events;     /*< Events consumed by readers */
+    unsigned long size_kb;              /*< Value of buffer_size_kb */
+};
+
+/**
+ * @brief State of a run in which the per CPU ring buffers are grown whenever
+ *        they are seen to lose events.
+ */
+struct itd_buffer_autosize {
+    unsigned int nr_cpus;
+    unsigned long budget_kb;            /*< Limit on the sum of all buffers */
+    uint64_t start_ns;
+    uint64_t last_ns;
+    struct itd_cpu_buffer_stats *first; /*< Per CPU stats at the start */
+    struct itd_cpu_buffer_stats *last;  /*< Per CPU stats at the last poll */
+    unsigned int *grown;                /*< Per CPU number of resizes */
+    bool *online;                       /*< Per CPU, has a tracefs entry */
+};
+
+/**
+ * @brief Start watching the per CPU ring buffers. Does not change tracing_on,
+ *        so can be used with or without itd_init_debug_tracing().
+ *
+ * @param budget_kb Memory the buffers of all CPUs may grow to in total.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+int itd_buffer_autosize_init(struct itd_buffer_autosize *const autosize,
+                             const unsigned long budget_kb);
+
+/**
+ * @brief Read every CPU's stats and double the buffer of each CPU that has
+ *        overrun or dropped events since the last poll, as far as the budget
+ *        allows. Call this periodically whilst tracing.
+ *
+ * @return Number of buffers grown or a negative errno value on failure.
+ */
+int itd_buffer_autosize_poll(struct itd_buffer_autosize *const autosize);
+
+/**
+ * @brief Print, per CPU, the final buffer size, the event rate and the events
+ *        lost since itd_buffer_autosize_init(). Uses the last poll's stats.
+ */
+void itd_buffer_autosize_report(const struct itd_buffer_autosize *const autosize,
+                                FILE *const out);
+
+/**
+ * @brief Free the resources of itd_buffer_autosize_init(). Buffer sizes are
+ *        left as they are so the captured trace can still be read.
+ */
+void itd_buffer_autosize_free(struct itd_buffer_autosize *const autosize);
+
+/**
+ * @brief What itd_set_function_filter() did and how long it took.
+ */
+struct itd_filter_stats {
+    size_t functions_indexed;   /*< Lines of available_filter_functions */
+    size_t functions_matched;   /*< Distinct functions written to the filter */
+    size_t unmatched_patterns;  /*< Patterns that matched nothing */
+    size_t writes;              /*< write() calls made to the filter file */
+    bool used_indexes;          /*< Functions written by index, not name */
+    uint64_t load_ns;           /*< Reading and indexing the function list */
+    uint64_t resolve_ns;        /*< Matching the patterns against the index */
+    uint64_t apply_ns;          /*< Writing the filter file */
+};
+
+/**
+ * @brief Set a function filter file, e.g. "set_ftrace_filter" or
+ *        "set_graph_function", from many patterns at once.
+ *
+ * Writing patterns one at a time makes the kernel rescan its whole function
+ * list for each of them. Instead available_filter_functions is read once into
+ * an in-memory hash index and each pattern is resolved against it here:
+ *
+ *  - "name"             an exact function name, a hash lookup
+ *  - "glob"             a glob using *, ? or [...], matched locally
+ *  - "glob:mod:module"  as above but only functions of `module`
+ *  - ":mod:module"      every function of `module`, e.g. ":mod:most_basic"
+ *
+ * The matched functions are then written through one open of the filter
+ * file, so the kernel builds and installs the new filter once rather than
+ * once per pattern. It still parses one function per write() whatever the
+ * buffer size, so most of the saving comes from how functions are named:
+ * where the kernel allows it (set_ftrace_filter and set_ftrace_notrace on
+ * Linux 5.3 onwards) they are written as indexes into
+ * available_filter_functions, which the kernel applies without any string
+ * matching at all. Otherwise functions are written by name, with a ":mod:"
+ * qualifier for module functions except in the graph filter files, which do
+ * not accept one. A name written without a qualifier also enables any other
+ * function of the same name.
+ *
+ * @param filter_file Filter file relative to the tracefs directory.
+ * @param patterns    Patterns as described above.
+ * @param append      Add to the current filter rather than replace it.
+ * @param stats       Filled in with what was done, may be NULL.
+ *
+ * @return 0 on success or a negative errno value on failure. -ENOENT means
+ *         nothing matched, in which case the filter is left untouched rather
+ *         than emptied (an empty filter traces every function). Unless
+ *         `append` is set, a failed write to the filter file can still
+ *         leave it emptied: the kernel installs only the functions written
+ *         before the failure, if any.
+ */
+int itd_set_function_filter(const char *const filter_file,
+                            const char *const *const patterns,
+                            const size_t nr_patterns, const bool append,
+                            struct itd_filter_stats *const stats);
+
 #endif /* ITD_FTRACE_DEBUGGING_H */
@@ -39,3 +39,82 @@ void itd_trace_print(const char *const fmt, ...)
     (void)fmt;
 }
 
+
+void itd_trace_dump(const char *const tag, const void *const buf,
+                    const size_t len)
+{
+    (void)tag;
+    (void)buf;
+    (void)len;
+}
+
+int itd_kprobe_create(const char *const event, const char *const symbol)
+{
+    (void)event;
+    (void)symbol;
+    return 0;
+}
+
+void itd_kprobe_destroy(const char *const event)
+{
+    (void)event;
+}
+
+int itd_latency_hist_create(const struct itd_latency_hist *const hist)
+{
+    (void)hist;
+    return 0;
+}
+
+ssize_t itd_latency_hist_read(const struct itd_latency_hist *const hist,
+                              char *const buf, const size_t size)
+{
+    (void)hist;
+    if (size)
+        buf[0] = '\0';
+    return 0;
+}
+
+void itd_latency_hist_destroy(const struct itd_latency_hist *const hist)
+{
+    (void)hist;
+}
+
+int itd_buffer_autosize_init(struct itd_buffer_autosize *const autosize,
+                             const unsigned long budget_kb)
+{
+    (void)autosize;
+    (void)budget_kb;
+    return 0;
+}
+
+int itd_buffer_autosize_poll(struct itd_buffer_autosize *const autosize)
+{
+    (void)autosize;
+    return 0;
+}
+
+void itd_buffer_autosize_report(const struct itd_buffer_autosize *const autosize,
+                                FILE *const out)
+{
+    (void)autosize;
+    (void)out;
+}
+
+void itd_buffer_autosize_free(struct itd_buffer_autosize *const autosize)
+{
+    (void)autosize;
+}
+
+int itd_set_function_filter(const char *const filter_file,
+                            const char *const *const patterns,
+                            const size_t nr_patterns, const bool append,
+                            struct itd_filter_stats *const stats)
+{
+    (void)filter_file;
+    (void)patterns;
+    (void)nr_patterns;
+    (void)append;
+    (void)stats;
+    return 0;
+}
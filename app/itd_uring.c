@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "itd_uring.h"
+
+static int sys_io_uring_setup(const unsigned int entries,
+                              struct io_uring_params *const params)
+{
+    const long result = syscall(__NR_io_uring_setup, entries, params);
+    return result < 0 ? -errno : (int)result;
+}
+
+static int sys_io_uring_enter(const int fd, const unsigned int to_submit,
+                              const unsigned int min_complete,
+                              const unsigned int flags)
+{
+    const long result = syscall(__NR_io_uring_enter, fd, to_submit,
+                                min_complete, flags, NULL, 0);
+    return result < 0 ? -errno : (int)result;
+}
+
+static int sys_io_uring_register(const int fd, const unsigned int opcode,
+                                 const void *const arg,
+                                 const unsigned int nr_args)
+{
+    const long result = syscall(__NR_io_uring_register, fd, opcode, arg,
+                                nr_args);
+    return result < 0 ? -errno : (int)result;
+}
+
+/*
+ * The ring offsets returned by the kernel are in bytes from the start of the
+ * mapping, hence the char pointer arithmetic.
+ */
+static void *ring_field(void *const base, const __u32 offset)
+{
+    return (char *)base + offset;
+}
+
+int itd_uring_init(struct itd_uring *const ring, const unsigned int entries)
+{
+    struct io_uring_params params;
+    int result;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = -1;
+
+    result = sys_io_uring_setup(entries, &params);
+    if (result < 0)
+        return result;
+    ring->ring_fd = result;
+
+    ring->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    /* Kernels with IORING_FEAT_SINGLE_MMAP share one mapping for both rings */
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring_ptr = mmap(NULL, ring->sq_ring_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                             IORING_OFF_SQ_RING);
+    if (ring->sq_ring_ptr == MAP_FAILED) {
+        result = -errno;
+        goto exit_no_sq_ring;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring_ptr = ring->sq_ring_ptr;
+    } else {
+        ring->cq_ring_ptr = mmap(NULL, ring->cq_ring_size,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                                 IORING_OFF_CQ_RING);
+        if (ring->cq_ring_ptr == MAP_FAILED) {
+            result = -errno;
+            goto exit_no_cq_ring;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        result = -errno;
+        goto exit_no_sqes;
+    }
+
+    ring->sq_head = ring_field(ring->sq_ring_ptr, params.sq_off.head);
+    ring->sq_tail = ring_field(ring->sq_ring_ptr, params.sq_off.tail);
+    ring->sq_mask = ring_field(ring->sq_ring_ptr, params.sq_off.ring_mask);
+    ring->sq_array = ring_field(ring->sq_ring_ptr, params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    ring->cq_head = ring_field(ring->cq_ring_ptr, params.cq_off.head);
+    ring->cq_tail = ring_field(ring->cq_ring_ptr, params.cq_off.tail);
+    ring->cq_mask = ring_field(ring->cq_ring_ptr, params.cq_off.ring_mask);
+    ring->cqes = ring_field(ring->cq_ring_ptr, params.cq_off.cqes);
+
+    return 0;
+
+exit_no_sqes:
+    if (ring->cq_ring_ptr != ring->sq_ring_ptr)
+        munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+exit_no_cq_ring:
+    munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+exit_no_sq_ring:
+    close(ring->ring_fd);
+    ring->ring_fd = -1;
+    return result;
+}
+
+void itd_uring_exit(struct itd_uring *const ring)
+{
+    if (ring->ring_fd < 0)
+        return;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_ptr != ring->sq_ring_ptr)
+        munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+    munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+    close(ring->ring_fd);
+    ring->ring_fd = -1;
+}
+
+int itd_uring_register_buffers(struct itd_uring *const ring,
+                               const struct iovec *const iovecs,
+                               const unsigned int nr_iovecs)
+{
+    return sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS,
+                                 iovecs, nr_iovecs);
+}
+
+int itd_uring_prep_read_fixed(struct itd_uring *const ring, const int fd,
+                              void *const buf, const unsigned int len,
+                              const uint64_t offset,
+                              const uint16_t buf_index,
+                              const uint64_t user_data)
+{
+    const unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (ring->sqe_tail - head >= ring->sq_entries)
+        return -EBUSY;
+
+    sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = buf_index;
+    sqe->user_data = user_data;
+
+    ring->sq_array[ring->sqe_tail & *ring->sq_mask] =
+        ring->sqe_tail & *ring->sq_mask;
+    ++ring->sqe_tail;
+
+    return 0;
+}
+
+int itd_uring_submit_and_wait(struct itd_uring *const ring,
+                              const unsigned int wait_nr)
+{
+    unsigned int to_submit;
+    int result;
+
+    /* Publish the new SQEs before the kernel can see the new tail */
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    /*
+     * Count from the kernel's head rather than the old tail - the kernel may
+     * have consumed fewer SQEs than it was asked to last time, and those
+     * must be asked for again.
+     */
+    to_submit =
+        ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (to_submit == 0U && wait_nr == 0U)
+        return 0;
+
+    do {
+        ++ring->enter_calls;
+        result = sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr,
+                                    wait_nr ? IORING_ENTER_GETEVENTS : 0U);
+    } while (result == -EINTR);
+
+    return result;
+}
+
+struct io_uring_cqe *itd_uring_peek_cqe(struct itd_uring *const ring)
+{
+    const unsigned int head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void itd_uring_cqe_seen(struct itd_uring *const ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1U, __ATOMIC_RELEASE);
+}
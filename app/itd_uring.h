@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef ITD_URING_H
+#define ITD_URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+ * @brief A minimal io_uring instance driven directly through the raw system
+ *        calls, so that the app does not need liburing to be installed.
+ *
+ * Only what the blog app needs is provided: fixed buffer registration,
+ * IORING_OP_READ_FIXED submission and completion reaping.
+ */
+struct itd_uring {
+    int ring_fd;
+
+    void *sq_ring_ptr;
+    size_t sq_ring_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned int sq_entries;
+    unsigned int sqe_tail;     /*< Local tail, ahead of *sq_tail until submit */
+
+    void *cq_ring_ptr;
+    size_t cq_ring_size;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned long enter_calls; /*< Number of io_uring_enter() syscalls made */
+};
+
+/**
+ * @brief Create an io_uring with at least `entries` submission queue slots.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+int itd_uring_init(struct itd_uring *const ring, const unsigned int entries);
+
+/**
+ * @brief Unmap the rings and close the io_uring file descriptor.
+ */
+void itd_uring_exit(struct itd_uring *const ring);
+
+/**
+ * @brief Register buffers with the kernel so that reads can use
+ *        IORING_OP_READ_FIXED and skip the per-I/O page pinning.
+ *
+ * @return 0 on success or a negative errno value on failure.
+ */
+int itd_uring_register_buffers(struct itd_uring *const ring,
+                               const struct iovec *const iovecs,
+                               const unsigned int nr_iovecs);
+
+/**
+ * @brief Queue a fixed buffer read. Nothing is passed to the kernel until
+ *        itd_uring_submit_and_wait() is called.
+ *
+ * @return 0 on success or -EBUSY if the submission queue is full.
+ */
+int itd_uring_prep_read_fixed(struct itd_uring *const ring, const int fd,
+                              void *const buf, const unsigned int len,
+                              const uint64_t offset,
+                              const uint16_t buf_index,
+                              const uint64_t user_data);
+
+/**
+ * @brief Submit all queued reads and wait for at least `wait_nr` completions
+ *        using a single io_uring_enter() system call. Any reads the kernel
+ *        did not take are submitted again by the next call.
+ *
+ * @return Number of submitted entries or a negative errno value on failure.
+ */
+int itd_uring_submit_and_wait(struct itd_uring *const ring,
+                              const unsigned int wait_nr);
+
+/**
+ * @brief Get the next completion without making a system call.
+ *
+ * @return Pointer to the completion or NULL if the completion queue is empty.
+ *         Call itd_uring_cqe_seen() once the completion has been consumed.
+ */
+struct io_uring_cqe *itd_uring_peek_cqe(struct itd_uring *const ring);
+
+/**
+ * @brief Mark the completion returned by itd_uring_peek_cqe() as consumed.
+ */
+void itd_uring_cqe_seen(struct itd_uring *const ring);
+
+#endif /* ITD_URING_H */
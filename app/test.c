@@ -15,34 +15,261 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+/*
+ * Route the library's write()s through fake_write() so that the filter
+ * writer can be fed a fake filter file.
+ */
+#define write fake_write
 #include "itd_ftrace_debugging.c" /*< Note C include! */
+#undef write
 #include "cstrings/get_line/get_line.h"
+#include <sys/syscall.h>
+
+/* Takes one token per write(), as the kernel's filter files do */
+#define FAKE_FILTER_FH 1000
+
+static char fake_filter[TRACEFS_COMMAND_SIZE];
+static size_t fake_filter_len;
+
+ssize_t fake_write(int fd, const void *buf, size_t len)
+{
+	const char *const end = memchr(buf, '\n', len);
+
+	if (fd != FAKE_FILTER_FH)
+		return (ssize_t)syscall(SYS_write, fd, buf, len);
+
+	if (end)
+		len = (size_t)(end - (const char *)buf) + 1U;
+	if (len > sizeof(fake_filter) - 1U - fake_filter_len)
+		len = sizeof(fake_filter) - 1U - fake_filter_len;
+	memcpy(fake_filter + fake_filter_len, buf, len);
+	fake_filter_len += len;
+	fake_filter[fake_filter_len] = '\0';
+
+	return (ssize_t)len;
+}
+
+static int check_hist_trigger(const struct itd_latency_hist *const hist,
+			      const enum latency_hist_trigger which,
+			      const char *const expected_event,
+			      const char *const expected_trigger,
+			      const char *const expected_filter)
+{
+	char event[TRACEFS_COMMAND_SIZE];
+	char trigger[TRACEFS_COMMAND_SIZE];
+	const char *filter;
+	int result;
+
+	result = format_latency_hist_trigger(hist, which, event, trigger, &filter);
+	printf("Test: %s\n      %s\n      %s\n", event, trigger,
+	       filter ? filter : "(no filter)");
+
+	if (result || strcmp(event, expected_event) != 0 ||
+	    strcmp(trigger, expected_trigger) != 0 ||
+	    (filter == NULL) != (expected_filter == NULL) ||
+	    (filter && strcmp(filter, expected_filter) != 0)) {
+		printf("FAIL: expected %s\n      %s\n      %s\n", expected_event,
+		       expected_trigger,
+		       expected_filter ? expected_filter : "(no filter)");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* An available_filter_functions with duplicates and a placeholder entry */
+static const char *const test_functions[] = {
+	"vfs_read",
+	"do_sys_open",
+	"",
+	"__ftrace_invalid_address___84",
+	"itdev_example_cdev_read [most_basic]",
+	"special_data_show [most_basic]",
+	"special_data_show [other_driver]",
+	"vfs_write",
+	"itdev_example_cdev_open [most_basic]",
+};
+
+#define NR_TEST_FUNCTIONS (sizeof(test_functions) / sizeof(test_functions[0]))
+
+static int build_test_index(struct function_index *const index)
+{
+	size_t i;
+	int result = 0;
+
+	memset(index, 0, sizeof(*index));
+	for (i = 0U; i < NR_TEST_FUNCTIONS && result == 0; ++i) {
+		char *const line = strdup(test_functions[i]);
+
+		result = line ? add_function_entry(index, line) : -ENOMEM;
+		if (result)
+			free(line);
+	}
+	if (result == 0)
+		result = build_function_hash(index);
+	if (result) {
+		printf("FAIL: could not build the function index\n");
+		free_function_index(index);
+	}
+
+	return result;
+}
+
+static int check_function_selection(const char *const pattern,
+				    const size_t expected_matches,
+				    const char *const expected_indexes)
+{
+	struct function_index index;
+	char indexes[TRACEFS_COMMAND_SIZE] = "";
+	size_t used = 0U;
+	size_t matches;
+	size_t i;
+
+	if (build_test_index(&index))
+		return 1;
+
+	matches = select_functions(&index, pattern);
+	for (i = 0U; i < index.count; ++i)
+		if (index.entries[i].selected)
+			used += (size_t)snprintf(indexes + used,
+						 sizeof(indexes) - used, "%s%zu",
+						 used ? " " : "", i + 1U);
+	free_function_index(&index);
+
+	printf("Test: %s selects %zu: %s\n", pattern, matches, indexes);
+	if (matches != expected_matches ||
+	    strcmp(indexes, expected_indexes) != 0) {
+		printf("FAIL: expected %zu: %s\n", expected_matches,
+		       expected_indexes);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int check_filter_write(const bool use_indexes,
+			      const bool qualify_modules,
+			      const char *const expected_filter)
+{
+	struct function_index index;
+	struct itd_filter_stats stats;
+	size_t tokens = 0U;
+	size_t i;
+	int result;
+
+	if (build_test_index(&index))
+		return 1;
+
+	select_functions(&index, ":mod:most_basic");
+	select_functions(&index, "vfs_*");
+	memset(&stats, 0, sizeof(stats));
+	fake_filter_len = 0U;
+	fake_filter[0] = '\0';
+	result = write_selected_functions(FAKE_FILTER_FH, &index, use_indexes,
+					  qualify_modules, &stats);
+	free_function_index(&index);
+
+	for (i = 0U; i < fake_filter_len; ++i)
+		if (fake_filter[i] == '\n')
+			++tokens;
+
+	printf("Test: by %s in %zu writes:\n%s",
+	       use_indexes ? "index" :
+	       qualify_modules ? "qualified name" : "name",
+	       stats.writes, fake_filter);
+	if (result || strcmp(fake_filter, expected_filter) != 0 ||
+	    stats.writes != tokens) {
+		printf("FAIL: expected %zu writes:\n%s", tokens,
+		       expected_filter);
+		return 1;
+	}
+
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
+	const struct itd_latency_hist hist = {
+		"itd_read_lat", "raw_syscalls/sys_enter", "id == 0",
+		"kprobes/read_special", NULL
+	};
+	int failures = 0;
+
 	(void)argc;
 	(void)argv;
 
 	allocate_and_set_tracefs_file_paths("/the/test/path", false);
-	printf("Test: %s\n      %s\n", tracing_on_file_path, trace_marker_file_path);
+	printf("Test: %s\n      %s\n      %s\n", tracing_on_file_path,
+	       trace_marker_file_path, tracefs_dir_path);
 	free(tracing_on_file_path);
 	free(trace_marker_file_path);
+	free(tracefs_dir_path);
 	tracing_on_file_path = NULL;
 	trace_marker_file_path = NULL;
+	tracefs_dir_path = NULL;
 
 	allocate_and_set_tracefs_file_paths("/the/test/path", true);
-	printf("Test: %s\n      %s\n", tracing_on_file_path, trace_marker_file_path);
+	printf("Test: %s\n      %s\n      %s\n", tracing_on_file_path,
+	       trace_marker_file_path, tracefs_dir_path);
 	free(tracing_on_file_path);
 	free(trace_marker_file_path);
+	free(tracefs_dir_path);
 	tracing_on_file_path = NULL;
 	trace_marker_file_path = NULL;
+	tracefs_dir_path = NULL;
 
 	find_tracefs();
-	printf("Test: %s\n      %s\n", tracing_on_file_path, trace_marker_file_path);
+	printf("Test: %s\n      %s\n      %s\n", tracing_on_file_path,
+	       trace_marker_file_path, tracefs_dir_path);
 	free(tracing_on_file_path);
 	free(trace_marker_file_path);
+	free(tracefs_dir_path);
 	tracing_on_file_path = NULL;
 	trace_marker_file_path = NULL;
+	tracefs_dir_path = NULL;
 
-	return 0;
+	failures += check_hist_trigger(
+		&hist, LATENCY_HIST_START, "raw_syscalls/sys_enter",
+		"hist:keys=common_pid:itd_read_lat_ts=common_timestamp",
+		"id == 0");
+	failures += check_hist_trigger(
+		&hist, LATENCY_HIST_END, "kprobes/read_special",
+		"hist:keys=common_pid:"
+		"itd_read_lat_lat=common_timestamp-$itd_read_lat_ts:"
+		"onmatch(raw_syscalls.sys_enter).itd_read_lat("
+		"$itd_read_lat_lat,common_pid)",
+		NULL);
+	failures += check_hist_trigger(&hist, LATENCY_HIST_SYNTH,
+				       "synthetic/itd_read_lat",
+				       "hist:keys=lat_ns.log2:sort=lat_ns", NULL);
+
+	/* Indexes count every line, including empty and placeholder ones */
+	failures += check_function_selection("vfs_write", 1U, "8");
+	failures += check_function_selection("special_data_show", 2U, "6 7");
+	failures += check_function_selection("no_such_function", 0U, "");
+	failures += check_function_selection("vfs_*", 2U, "1 8");
+	failures += check_function_selection("itdev_*:mod:most_basic", 2U,
+					     "5 9");
+	failures += check_function_selection("special_data_show:mod:other*",
+					     1U, "7");
+	failures += check_function_selection(":mod:most_basic", 3U, "5 6 9");
+	failures += check_function_selection("vfs_read:mod:most_basic", 0U, "");
+
+	/* Every token must get through, not just the first of each buffer */
+	failures += check_filter_write(true, true, "1\n5\n6\n8\n9\n");
+	failures += check_filter_write(
+		false, true, "vfs_read\n"
+		       "itdev_example_cdev_read:mod:most_basic\n"
+		       "special_data_show:mod:most_basic\n"
+		       "vfs_write\n"
+		       "itdev_example_cdev_open:mod:most_basic\n");
+	/* The graph filter files do not take ":mod:" */
+	failures += check_filter_write(false, false,
+				       "vfs_read\n"
+				       "itdev_example_cdev_read\n"
+				       "special_data_show\n"
+				       "vfs_write\n"
+				       "itdev_example_cdev_open\n");
+
+	return failures ? 1 : 0;
 }
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * DESCRIPTION:
+ *   Run a command whilst watching the ftrace ring buffers. Any CPU whose
+ *   buffer overruns or drops events has its buffer_size_kb doubled, up to a
+ *   total memory budget, so that later events are not lost. When the command
+ *   exits the event rate and losses of each CPU are printed to stderr.
+ *
+ *   tracing_on is left alone, so tracing can be controlled by the caller or
+ *   by the command itself.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "itd_ftrace_debugging.h"
+
+#define DEFAULT_BUDGET_KB (64UL * 1024UL)
+#define DEFAULT_INTERVAL_MS 100UL
+
+static void usage(const char *const prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-b budget_kb] [-i interval_ms] command [args...]\n"
+            "  -b  Total size all CPU buffers may grow to (default %lu)\n"
+            "  -i  How often to check for lost events (default %lu)\n",
+            prog, DEFAULT_BUDGET_KB, DEFAULT_INTERVAL_MS);
+}
+
+static int parse_count(const char *const arg, unsigned long *const value)
+{
+    char *end = NULL;
+
+    errno = 0;
+    *value = strtoul(arg, &end, 0);
+    if (errno || !end || *end != '\0' || *value == 0U)
+        return -EINVAL;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct itd_buffer_autosize autosize;
+    unsigned long budget_kb = DEFAULT_BUDGET_KB;
+    unsigned long interval_ms = DEFAULT_INTERVAL_MS;
+    struct timespec interval;
+    int ret_val = EXIT_FAILURE;
+    int status = 0;
+    pid_t child;
+    int result;
+    int opt;
+
+    /* "+" stops at the command so its own options are passed on to it */
+    while ((opt = getopt(argc, argv, "+b:i:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (parse_count(optarg, &budget_kb))
+                goto exit_usage;
+            break;
+        case 'i':
+            if (parse_count(optarg, &interval_ms))
+                goto exit_usage;
+            break;
+        default:
+            goto exit_usage;
+        }
+    }
+
+    if (optind >= argc)
+        goto exit_usage;
+
+    result = itd_buffer_autosize_init(&autosize, budget_kb);
+    if (result) {
+        fprintf(stderr, "Failed to read ring buffer stats: %s\n",
+                strerror(-result));
+        goto exit_main;
+    }
+
+    child = fork();
+    if (child < 0) {
+        perror("Failed to fork");
+        goto exit_free;
+    }
+    if (child == 0) {
+        execvp(argv[optind], &argv[optind]);
+        perror("Failed to run command");
+        _exit(127);
+    }
+
+    interval.tv_sec = (time_t)(interval_ms / 1000UL);
+    interval.tv_nsec = (long)(interval_ms % 1000UL) * 1000000L;
+
+    while ((result = (int)waitpid(child, &status, WNOHANG)) == 0) {
+        if (itd_buffer_autosize_poll(&autosize) > 0)
+            fprintf(stderr, "Grew ring buffers after lost events\n");
+        nanosleep(&interval, NULL);
+    }
+
+    /* One last look so that losses near the end are reported */
+    itd_buffer_autosize_poll(&autosize);
+    itd_buffer_autosize_report(&autosize, stderr);
+
+    if (result > 0 && WIFEXITED(status))
+        ret_val = WEXITSTATUS(status);
+
+exit_free:
+    itd_buffer_autosize_free(&autosize);
+exit_main:
+    return ret_val;
+
+exit_usage:
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
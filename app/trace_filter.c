@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2019 IT Dev Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * DESCRIPTION:
+ *   Set an ftrace function filter file from many names, globs and module
+ *   scopes at once, rather than echoing them in one at a time. See
+ *   itd_set_function_filter() for how this is done quickly. How long each
+ *   stage took is reported on stderr.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "itd_ftrace_debugging.h"
+#include "cstrings/get_line/get_line.h"
+
+#define NS_PER_MS 1000000.0
+
+static void usage(const char *const prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-f filter_file] [-a] [-p patterns_file] "
+            "[pattern...]\n"
+            "  -f  Filter file to set (default set_ftrace_filter), e.g.\n"
+            "      set_graph_function or set_ftrace_notrace\n"
+            "  -a  Add to the current filter rather than replacing it\n"
+            "  -p  Also read patterns, one per line, from a file\n"
+            "  Patterns are names, globs, glob:mod:module or :mod:module\n",
+            prog);
+}
+
+/*
+ * Append every non-empty line of a file to the pattern list.
+ */
+static int read_patterns_file(const char *const path, char ***const patterns,
+                              size_t *const nr_patterns)
+{
+    char *line = NULL;
+    size_t buff_size = 0;
+    FILE *const patterns_fh = fopen(path, "r");
+    int result = 0;
+
+    if (!patterns_fh)
+        return -errno;
+
+    while (1) {
+        char **new_patterns;
+
+        result = read_line(patterns_fh, &line, &buff_size);
+        if (result < 0 || line == NULL)
+            break;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            free(line);
+            line = NULL;
+            continue;
+        }
+
+        new_patterns = realloc(*patterns,
+                               (*nr_patterns + 1U) * sizeof(**patterns));
+        if (!new_patterns) {
+            free(line);
+            result = -ENOMEM;
+            break;
+        }
+        *patterns = new_patterns;
+        (*patterns)[(*nr_patterns)++] = line;
+        line = NULL;
+    }
+
+    fclose(patterns_fh);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter_file = "set_ftrace_filter";
+    const char *patterns_file = NULL;
+    struct itd_filter_stats stats;
+    char **patterns = NULL;
+    size_t nr_patterns = 0U;
+    size_t nr_file_patterns = 0U;
+    bool append = false;
+    int ret_val = EXIT_FAILURE;
+    int result;
+    int opt;
+    size_t i;
+
+    while ((opt = getopt(argc, argv, "f:ap:")) != -1) {
+        switch (opt) {
+        case 'f':
+            filter_file = optarg;
+            break;
+        case 'a':
+            append = true;
+            break;
+        case 'p':
+            patterns_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (patterns_file) {
+        result = read_patterns_file(patterns_file, &patterns, &nr_patterns);
+        /* Lines read before a failure are ours to free too */
+        nr_file_patterns = nr_patterns;
+        if (result) {
+            fprintf(stderr, "Failed to read %s: %s\n", patterns_file,
+                    strerror(-result));
+            goto exit_main;
+        }
+    }
+
+    for (; optind < argc; ++optind) {
+        char **const new_patterns =
+            realloc(patterns, (nr_patterns + 1U) * sizeof(*patterns));
+
+        if (!new_patterns)
+            goto exit_main;
+        patterns = new_patterns;
+        patterns[nr_patterns++] = argv[optind];
+    }
+
+    if (nr_patterns == 0U) {
+        usage(argv[0]);
+        goto exit_main;
+    }
+
+    result = itd_set_function_filter(filter_file,
+                                     (const char *const *)patterns,
+                                     nr_patterns, append, &stats);
+
+    fprintf(stderr,
+            "Indexed %zu functions in %.1f ms\n"
+            "Matched %zu functions in %.1f ms (%zu patterns matched "
+            "nothing)\n",
+            stats.functions_indexed, (double)stats.load_ns / NS_PER_MS,
+            stats.functions_matched, (double)stats.resolve_ns / NS_PER_MS,
+            stats.unmatched_patterns);
+
+    if (result) {
+        fprintf(stderr, "Failed to set %s: %s\n", filter_file,
+                strerror(-result));
+        goto exit_main;
+    }
+
+    fprintf(stderr, "Set %s by %s in %zu writes, %.1f ms\n", filter_file,
+            stats.used_indexes ? "index" : "name", stats.writes,
+            (double)stats.apply_ns / NS_PER_MS);
+    ret_val = EXIT_SUCCESS;
+
+exit_main:
+    for (i = 0U; i < nr_file_patterns; ++i)
+        free(patterns[i]);
+    free(patterns);
+    return ret_val;
+}
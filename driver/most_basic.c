@@ -24,6 +24,9 @@
 #include <linux/uaccess.h>
 #include <linux/device.h>
 #include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 
 /*
  * Forward declarations
@@ -35,6 +38,8 @@ static ssize_t itdev_example_cdev_read_special_data(struct file *file_ptr,
 						    size_t size);
 static ssize_t itdev_example_cdev_read(struct file *file, char __user *buf,
 				       size_t length, loff_t *offset);
+static ssize_t read_stats_show(struct device *dev,
+			       struct device_attribute *attr, char *buf);
 static int __init itdev_example_cdev_init(void);
 static void __exit itdev_example_cdev_exit(void);
 
@@ -47,6 +52,13 @@ static void __exit itdev_example_cdev_exit(void);
 /* Prefix for debug output - makes for easier grepping */
 #define TAG "ITDev: "
 
+/*
+ * Number of log2 read latency buckets. Bucket 0 counts reads taking 0ns and
+ * bucket n those taking [2^(n-1), 2^n) ns. The last bucket also counts
+ * everything slower.
+ */
+#define LATENCY_BUCKETS 32U
+
 /* 
  * Define DEBUG to enable some of the trace_printk() output that we
  * imagine the developer using to debug the issue with this code.
@@ -68,6 +80,29 @@ static size_t test_read_msg_len = 25U;
 static const char test_data_block[] = "AABBCCDDEEFFGGHHIIJJKK";
 static size_t test_data_block_len = 22U;
 
+/*
+ * Read statistics for one of the driver's files. Each CPU has its own copy
+ * which only it updates, using this_cpu operations, so the read paths take
+ * no locks and share no cache lines. read_stats_show() sums the copies. On
+ * 32-bit machines a sum may see a torn 64-bit counter, which is acceptable
+ * for monitoring.
+ *
+ * reads      - Number of successful reads.
+ * bytes      - Total bytes returned by those reads.
+ * latency_ns - log2 histogram of the time spent in the read function.
+ */
+struct itdev_read_stats {
+	u64 reads;
+	u64 bytes;
+	u64 latency_ns[LATENCY_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct itdev_read_stats, cdev_read_stats);
+static DEFINE_PER_CPU(struct itdev_read_stats, special_read_stats);
+
+/* /sys/devices/itdev/read_stats */
+static DEVICE_ATTR_RO(read_stats);
+
 /*
  * A character device driver receives these unaltered system calls. We only
  * need to define the useful fields - everything else is implicitly initialised
@@ -100,6 +135,88 @@ struct itdev_example_cdev_ctx {
 /*
  * Functions
  */
+/*
+ * Account one successful read that began at `start` on this CPU's copy of
+ * `stats`.
+ */
+static void itdev_record_read(struct itdev_read_stats __percpu *stats,
+			      size_t bytes, ktime_t start)
+{
+	const u64 delta_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	unsigned int bucket = delta_ns ? ilog2(delta_ns) + 1U : 0U;
+
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1U;
+
+	this_cpu_inc(stats->reads);
+	this_cpu_add(stats->bytes, bytes);
+	this_cpu_inc(stats->latency_ns[bucket]);
+}
+
+/*
+ * Sum every CPU's copy of `stats` into `total`.
+ */
+static void itdev_sum_read_stats(struct itdev_read_stats __percpu *stats,
+				 struct itdev_read_stats *total)
+{
+	unsigned int cpu;
+	unsigned int i;
+
+	memset(total, 0, sizeof(*total));
+	for_each_possible_cpu(cpu) {
+		const struct itdev_read_stats *cpu_stats =
+			per_cpu_ptr(stats, cpu);
+
+		total->reads += READ_ONCE(cpu_stats->reads);
+		total->bytes += READ_ONCE(cpu_stats->bytes);
+		for (i = 0; i < LATENCY_BUCKETS; ++i)
+			total->latency_ns[i] +=
+				READ_ONCE(cpu_stats->latency_ns[i]);
+	}
+}
+
+/*
+ * Append the summed statistics of one file to a sysfs buffer holding `len`
+ * bytes, returning the new length.
+ */
+static int itdev_show_read_stats(char *buf, int len, const char *name,
+				 struct itdev_read_stats __percpu *stats)
+{
+	struct itdev_read_stats total;
+	unsigned int i;
+
+	itdev_sum_read_stats(stats, &total);
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "%s_reads %llu\n",
+			 name, total.reads);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "%s_bytes %llu\n",
+			 name, total.bytes);
+	for (i = 0; i < LATENCY_BUCKETS - 1U; ++i)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s_latency_ns_lt_%llu %llu\n", name,
+				 1ULL << i, total.latency_ns[i]);
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			 "%s_latency_ns_lt_inf %llu\n", name,
+			 total.latency_ns[LATENCY_BUCKETS - 1U]);
+
+	return len;
+}
+
+/*
+ * Show the read statistics of both files, one "name value" pair per line, so
+ * that they can be scraped without an ftrace session.
+ */
+static ssize_t read_stats_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	int len = 0;
+
+	len = itdev_show_read_stats(buf, len, "cdev", &cdev_read_stats);
+	len = itdev_show_read_stats(buf, len, "special", &special_read_stats);
+
+	return len;
+}
+
 /*
  * The read routine for our driver's "special" file, which appears at
  * /sys/devices/itdev/special_file. It will return a block of data of a fixed
@@ -111,6 +228,8 @@ static ssize_t itdev_example_cdev_read_special_data(struct file *file_ptr,
 						    char *data, loff_t offset,
 						    size_t size)
 {
+	const ktime_t start = ktime_get();
+
 #ifdef DEBUG
 	trace_printk(TAG "Reading %zu bytes\n", size);
 #endif
@@ -119,6 +238,7 @@ static ssize_t itdev_example_cdev_read_special_data(struct file *file_ptr,
 		return -EINVAL;
 
 	memcpy(data, test_data_block, test_data_block_len);
+	itdev_record_read(&special_read_stats, test_data_block_len, start);
 	return test_data_block_len;
 }
 
@@ -129,6 +249,7 @@ static ssize_t itdev_example_cdev_read_special_data(struct file *file_ptr,
 static ssize_t itdev_example_cdev_read(struct file *file, char __user *buf,
 				       size_t length, loff_t *offset)
 {
+	const ktime_t start = ktime_get();
 	ssize_t bytes_read = 0;
 
 	if (*offset < test_read_msg_len) {
@@ -139,6 +260,7 @@ static ssize_t itdev_example_cdev_read(struct file *file, char __user *buf,
 		*offset += bytes_read;
 	}
 
+	itdev_record_read(&cdev_read_stats, bytes_read, start);
 	return bytes_read;
 }
 
@@ -218,8 +340,15 @@ static int __init itdev_example_cdev_init(void)
 	if (result)
 		goto bin_file_failed;
 
+	/* Create /sys/devices/itdev/read_stats */
+	result = device_create_file(gbl_ctx.sysfsdev, &dev_attr_read_stats);
+	if (result)
+		goto stats_file_failed;
+
 	return 0;
 
+stats_file_failed:
+	sysfs_remove_bin_file(&gbl_ctx.sysfsdev->kobj, &gbl_ctx.battr);
 bin_file_failed:
 	root_device_unregister(gbl_ctx.sysfsdev);
 cdev_add_failed:
@@ -236,6 +365,7 @@ module_init(itdev_example_cdev_init);
 static void __exit itdev_example_cdev_exit(void)
 {
 	pr_info(TAG "ITDev Ltd. example cdev exit\n");
+	device_remove_file(gbl_ctx.sysfsdev, &dev_attr_read_stats);
 	sysfs_remove_bin_file(&gbl_ctx.sysfsdev->kobj, &gbl_ctx.battr);
 	root_device_unregister(gbl_ctx.sysfsdev);
 	cdev_del(gbl_ctx.pdev);
@@ -7,6 +7,9 @@ echo 0 > tracing_on
 echo function_graph > current_tracer
 #echo function > current_tracer
 echo itdev_example_cdev_read_special_data > set_graph_function
+# For many functions, globs or a whole module use the indexed filter builder:
+# /path/to/app/trace_filter -f set_graph_function ':mod:most_basic'
+# /path/to/app/trace_filter -p functions.txt   # -> set_ftrace_filter
 #echo itdev_example_cdev_read_special_data > set_ftrace_filter
 # echo > set_ftrace_filter
 echo 1 > options/func_stack_trace